@@ -6,14 +6,37 @@
 #include <cassert>
 #include <vector>
 #include <util/optional.hpp>
+#include <util/spsc_queue.hpp>
+#include <audio_block.hpp>
+#include <audio_worker_pool.hpp>
+#include <core/lens.hpp>
+#include <core/app_state.hpp>
 #include <span>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+#include <array>
+#include <chrono>
 
 namespace weave {
 
 struct audio_buffer_format {
-  int sample_rate = 44100;
+  /// 0 for the native sample rate of the device, which avoids a resampling by the system
+  int sample_rate = 0;
+  /// In frames, 0 for the default period size of the device
   int buffer_size = 512;
   unsigned char num_channels = 2;
+  /// If not 0, the device also captures audio (full duplex), given to render_audio
+  /// with an audio_input_stream
+  unsigned char num_input_channels = 0;
+  /// Ask the backend for its low latency mode, at the cost of more CPU usage
+  bool low_latency = true;
 };
 
 struct audio_buffer : std::vector<float> {
@@ -22,6 +45,402 @@ struct audio_buffer : std::vector<float> {
 
 optional<audio_buffer> read_audio_file(const std::string& path);
 
+/// Min, max and sum of squares of a block of samples
+struct waveform_peak {
+  
+  float rms() const { return num_frames ? std::sqrt(sum_squares / num_frames) : 0.f; }
+  
+  waveform_peak merge(const waveform_peak& o) const {
+    return {std::min(min, o.min), std::max(max, o.max), 
+            sum_squares + o.sum_squares, num_frames + o.num_frames};
+  }
+  
+  float min = 0;
+  float max = 0;
+  // Note : the blocks merged can have different sizes, so the mean square is only computed by rms
+  float sum_squares = 0;
+  std::size_t num_frames = 0;
+};
+
+/// A mip-map of the peaks of an interleaved audio buffer, to draw it at any zoom level 
+/// in a time proportional to the number of pixels instead of the number of samples.
+/// Level l holds one waveform_peak per channel for every block of (block_size << l) frames.
+struct waveform_peaks {
+  
+  static constexpr std::size_t block_size = 256;
+  
+  int num_channels() const { return num_channels_v; }
+  std::size_t num_frames() const { return num_frames_v; }
+  int num_levels() const { return levels.size(); }
+  
+  /// Incremented by every build or update
+  unsigned version() const { return version_v; }
+  
+  /// Compute every level. Level 0 is split in num_threads parts computed in parallel.
+  void build(std::span<const float> samples, int num_channels, unsigned num_threads = 1)
+  {
+    assert( num_channels > 0 && "waveform_peaks needs at least one channel" );
+    num_channels_v = num_channels;
+    num_frames_v = samples.size() / num_channels;
+    levels.clear();
+    ++version_v;
+    if (!num_frames_v)
+      return;
+    
+    levels.emplace_back( num_blocks(0) * num_channels );
+    auto blocks = num_blocks(0);
+    num_threads = std::clamp<std::size_t>(num_threads, 1, blocks);
+    if (num_threads == 1)
+      compute_blocks(samples, 0, blocks);
+    else {
+      std::vector<std::thread> workers;
+      auto per_thread = (blocks + num_threads - 1) / num_threads;
+      for (std::size_t b = 0; b < blocks; b += per_thread)
+        workers.emplace_back( [this, samples, b, e = std::min(b + per_thread, blocks)] { 
+          compute_blocks(samples, b, e); 
+        });
+      for (auto& w : workers)
+        w.join();
+    }
+    
+    while (levels.back().size() > (std::size_t)num_channels) {
+      levels.emplace_back( num_blocks(levels.size()) * num_channels );
+      merge_blocks(levels.size() - 1, 0, num_blocks(levels.size() - 1));
+    }
+  }
+  
+  /// Recompute the peaks of the frames in [first, last) after an edit of samples.
+  /// If the number of frames changed, everything is rebuilt.
+  void update(std::span<const float> samples, std::size_t first, std::size_t last)
+  {
+    if (!num_channels_v || samples.size() / num_channels_v != num_frames_v)
+      return build(samples, std::max(num_channels_v, 1));
+    if (first >= last)
+      return;
+    ++version_v;
+    auto b = first / block_size;
+    auto e = (std::min(last, num_frames_v) + block_size - 1) / block_size;
+    compute_blocks(samples, b, e);
+    for (int l = 1; l < num_levels(); ++l) {
+      b /= 2;
+      e = (e + 1) / 2;
+      merge_blocks(l, b, e);
+    }
+  }
+  
+  /// The peak of the frames in [first, last) of a channel, at the resolution of the level
+  /// whose blocks are smaller than the range, so only a few blocks are merged.
+  /// If samples (the buffer the peaks were built from) is given, ranges smaller 
+  /// than a block are computed exactly from it.
+  waveform_peak query(int channel, std::size_t first, std::size_t last, 
+                      std::span<const float> samples = {}) const
+  {
+    last = std::min(last, num_frames_v);
+    if (first >= last)
+      return {};
+    if (last - first < block_size && !samples.empty())
+      return compute_peak(samples, channel, first, last);
+    
+    int l = std::min<int>(std::bit_width((last - first) / block_size) - 1, num_levels() - 1);
+    l = std::max(l, 0);
+    auto bs = block_size << l;
+    auto& level = levels[l];
+    waveform_peak res = level[(first / bs) * num_channels_v + channel];
+    for (auto b = first / bs + 1; b < (last + bs - 1) / bs; ++b)
+      res = res.merge(level[b * num_channels_v + channel]);
+    return res;
+  }
+  
+  /// Fill out with the peaks of consecutive ranges of frames_per_column frames, starting at first
+  void columns(int channel, double first, double frames_per_column, std::span<waveform_peak> out,
+               std::span<const float> samples = {}) const 
+  {
+    for (std::size_t k = 0; k < out.size(); ++k) {
+      auto a = (std::size_t)std::max(0., first + k * frames_per_column);
+      auto b = (std::size_t)std::max(0., first + (k + 1) * frames_per_column);
+      out[k] = query(channel, a, std::max(b, a + 1), samples);
+    }
+  }
+  
+  private : 
+  
+  std::size_t num_blocks(std::size_t level) const {
+    auto bs = block_size << level;
+    return (num_frames_v + bs - 1) / bs;
+  }
+  
+  waveform_peak compute_peak(std::span<const float> samples, int channel, 
+                             std::size_t first, std::size_t last) const
+  {
+    float mn = samples[first * num_channels_v + channel];
+    float mx = mn;
+    float sq = 0;
+    for (auto i = first * num_channels_v + channel; i < last * num_channels_v; i += num_channels_v) {
+      auto v = samples[i];
+      mn = std::min(mn, v);
+      mx = std::max(mx, v);
+      sq += v * v;
+    }
+    return {mn, mx, sq, last - first};
+  }
+  
+  void compute_blocks(std::span<const float> samples, std::size_t b, std::size_t e) {
+    for (; b < e; ++b)
+      for (int c = 0; c < num_channels_v; ++c)
+        levels[0][b * num_channels_v + c] = 
+          compute_peak(samples, c, b * block_size, std::min(num_frames_v, (b + 1) * block_size));
+  }
+  
+  void merge_blocks(int l, std::size_t b, std::size_t e) {
+    auto& prev = levels[l - 1];
+    auto& level = levels[l];
+    e = std::min(e, level.size() / num_channels_v);
+    for (; b < e; ++b)
+      for (int c = 0; c < num_channels_v; ++c) {
+        auto i = 2 * b * num_channels_v + c;
+        auto& p = prev[i];
+        level[b * num_channels_v + c] = (i + num_channels_v < prev.size()) ? p.merge(prev[i + num_channels_v]) : p;
+      }
+  }
+  
+  std::vector<std::vector<waveform_peak>> levels;
+  std::size_t num_frames_v = 0;
+  int num_channels_v = 0;
+  unsigned version_v = 0;
+};
+
+/// Converts the sample rate of interleaved float audio, eg. to play a file at the rate of the device.
+/// Uses the resampler of miniaudio, with its highest order low pass filter.
+struct audio_resampler {
+  
+  audio_resampler() = default;
+  audio_resampler(const audio_resampler&) = delete;
+  audio_resampler& operator=(const audio_resampler&) = delete;
+  
+  ~audio_resampler() { uninit(); }
+  
+  /// Not realtime safe
+  bool init(int num_channels, int input_rate, int output_rate) {
+    uninit();
+    auto config = ma_resampler_config_init(ma_format_f32, num_channels, input_rate, output_rate, 
+                                           ma_resample_algorithm_linear);
+    config.linear.lpfOrder = MA_MAX_FILTER_ORDER;
+    if (ma_resampler_init(&config, nullptr, &state) != MA_SUCCESS)
+      return false;
+    is_init = true;
+    channels = num_channels;
+    return true;
+  }
+  
+  bool is_initialized() const { return is_init; }
+  
+  struct process_result {
+    std::size_t frames_read, frames_written;
+  };
+  
+  /// Convert as many frames of in as possible into out
+  process_result process(std::span<const float> in, std::span<float> out) {
+    assert( is_init && "audio_resampler used before init" );
+    ma_uint64 in_frames = in.size() / channels;
+    ma_uint64 out_frames = out.size() / channels;
+    ma_resampler_process_pcm_frames(&state, in.data(), &in_frames, out.data(), &out_frames);
+    return {(std::size_t)in_frames, (std::size_t)out_frames};
+  }
+  
+  /// The number of output frames for a number of input frames
+  std::size_t output_frames(std::size_t input_frames) const {
+    ma_uint64 res = 0;
+    ma_resampler_get_expected_output_frame_count(const_cast<ma_resampler*>(&state), input_frames, &res);
+    return res;
+  }
+  
+  /// Forget the previous frames, eg. after a seek
+  void reset() {
+    if (is_init)
+      ma_resampler_reset(&state);
+  }
+  
+  private : 
+  
+  void uninit() {
+    if (is_init)
+      ma_resampler_uninit(&state, nullptr);
+    is_init = false;
+  }
+  
+  ma_resampler state;
+  int channels = 0;
+  bool is_init = false;
+};
+
+/// Streams an audio file (mp3, flac or wav) : a background thread decodes it chunk by chunk 
+/// into a ring buffer, which is read from the audio thread.
+/// Only a few seconds of audio are decoded ahead, whatever the length of the file.
+struct audio_file_reader {
+  
+  audio_file_reader();
+  ~audio_file_reader();
+  
+  audio_file_reader(const audio_file_reader&) = delete;
+  audio_file_reader& operator=(const audio_file_reader&) = delete;
+  
+  /// Open a file and start decoding it, closing the previous one.
+  /// If output_rate isn't 0 nor the rate of the file, the decoding thread also resamples 
+  /// the file to output_rate.
+  /// Must not be called while the audio thread reads.
+  bool open(const std::string& path, int output_rate = 0);
+  
+  void close();
+  
+  bool is_open() const { return num_channels_v != 0; }
+  
+  int num_channels() const { return num_channels_v; }
+  
+  /// The sample rate of the file
+  int sample_rate() const { return sample_rate_v; }
+  
+  /// The sample rate of the frames given by read
+  int output_sample_rate() const { return output_rate_v; }
+  
+  /// The length of the file in frames, 0 until known
+  std::uint64_t total_frames() const { return total_frames_v.load(std::memory_order_relaxed); }
+  
+  /// The frame of the file the next call to read will start from
+  std::uint64_t position() const { return position_v.load(std::memory_order_relaxed); }
+  
+  /// Audio thread : read interleaved frames into out, returns the number of frames read, 
+  /// which can be less than requested if the decoder is late or at the end of the file.
+  /// Never locks nor allocates.
+  std::size_t read(std::span<float> out);
+  
+  /// Jump to a frame. Can be called from any thread but the audio thread
+  void seek(std::uint64_t frame);
+  
+  /// True once every frame of the file was read
+  bool at_end() const {
+    return decoded_all.load(std::memory_order_acquire) && ring.available() == 0 
+           && seek_request.load(std::memory_order_relaxed) < 0;
+  }
+  
+  struct decoder;
+  
+  private : 
+  
+  void decode_loop();
+  
+  std::unique_ptr<decoder> dec;
+  std::thread worker;
+  spsc_ring_buffer<float> ring;
+  int num_channels_v = 0;
+  int sample_rate_v = 0;
+  int output_rate_v = 0;
+  std::atomic<std::uint64_t> total_frames_v = 0;
+  std::atomic<std::uint64_t> position_v = 0;
+  std::atomic<bool> quit = false;
+  std::atomic<bool> decoded_all = false;
+  std::atomic<std::int64_t> seek_request = -1;
+  // set by the decoder thread after a seek : the ring position where the new data starts,
+  // and the frame it corresponds to
+  std::atomic<std::size_t> discard_until = no_discard;
+  std::atomic<std::uint64_t> seek_frame = 0;
+  // owned by the audio thread, to compute the position when resampling
+  std::uint64_t position_base = 0;
+  std::uint64_t frames_since_seek = 0;
+  
+  static constexpr std::size_t no_discard = std::size_t(-1);
+};
+
+/// Decoded audio mapped from an audio_file_cache file.
+/// The samples stay valid as long as this object lives, even if the file is evicted.
+struct mapped_audio {
+  
+  mapped_audio() = default;
+  mapped_audio(mapped_audio&& o) { *this = std::move(o); }
+  mapped_audio& operator=(mapped_audio&& o);
+  ~mapped_audio();
+  
+  /// Interleaved samples
+  std::span<const float> samples() const { return data; }
+  
+  int num_channels() const { return num_channels_v; }
+  int sample_rate() const { return sample_rate_v; }
+  std::size_t num_frames() const { return num_channels_v ? data.size() / num_channels_v : 0; }
+  
+  private : 
+  
+  friend struct audio_file_cache;
+  
+  void* base = nullptr;
+  std::size_t mapped_size = 0;
+  std::span<const float> data;
+  int num_channels_v = 0;
+  int sample_rate_v = 0;
+};
+
+/// An on-disk cache of decoded audio files, as raw float PCM which is memory mapped
+/// when opened, so that opening a cached file neither decodes nor copies it.
+/// Entries are keyed by path, modification time and size of the source file, which are checked
+/// against the ones stored in the entry when it's opened, and the least
+/// recently opened entries are removed when the total size of the cache goes over max_bytes.
+/// The cache can be used from several threads, and several processes can share its directory.
+struct audio_file_cache {
+  
+  audio_file_cache(std::string directory, std::uint64_t max_bytes = std::uint64_t(2) << 30);
+  
+  /// Map the decoded content of the file at path, decoding it first if it isn't cached
+  optional<mapped_audio> open(const std::string& path);
+  
+  /// True if path is cached and up to date
+  bool contains(const std::string& path) const;
+  
+  /// Remove the entries until the cache is at most max_bytes
+  void trim(std::uint64_t max_bytes);
+  
+  void clear() { trim(0); }
+  
+  const std::string& directory() const { return dir; }
+  
+  private : 
+  
+  optional<std::string> entry_path(const std::string& path) const;
+  bool decode_to(const std::string& path, const std::string& entry);
+  
+  std::string dir;
+  std::uint64_t max_bytes;
+  std::mutex mut;
+};
+
+/// Writes interleaved float audio to a 32 bits float WAV file
+struct audio_file_writer {
+  
+  audio_file_writer();
+  ~audio_file_writer();
+  
+  audio_file_writer(const audio_file_writer&) = delete;
+  audio_file_writer& operator=(const audio_file_writer&) = delete;
+  
+  bool open(const std::string& path, int num_channels, int sample_rate);
+  
+  /// Write the file header and close it, returns false if writing the header failed
+  bool close();
+  
+  bool is_open() const { return wav != nullptr; }
+  
+  /// Returns the number of frames written
+  std::size_t write(std::span<const float> samples);
+  
+  private : 
+  
+  struct wav_state;
+  std::unique_ptr<wav_state> wav;
+  int num_channels = 0;
+};
+
+/// Same as audio_file_cache::open
+inline optional<mapped_audio> read_audio_file(const std::string& path, audio_file_cache& cache) {
+  return cache.open(path);
+}
+
 struct audio_device_handle {
   
   std::string_view name() const { return device->name; }
@@ -94,6 +513,101 @@ struct audio_output_stream {
   int n_frames;
 };
 
+/// The captured audio given to render_audio, interleaved. 
+/// Points directly to the buffer of the device, and is only valid during the call.
+struct audio_input_stream {
+  
+  auto num_samples() const { return n_frames * n_channels; }
+  auto buffer_size() const { return n_frames; }
+  
+  auto begin() const { return std::span<const float>(ptr, num_samples()).begin();  }
+  auto end()   const { return std::span<const float>(ptr, num_samples()).end();    }
+  
+  /// The frames in [offset, offset + count)
+  audio_input_stream subrange(int offset, int count) const {
+    return {ptr ? ptr + offset * n_channels : nullptr, n_channels, count};
+  }
+  
+  const float* ptr;
+  int n_channels;
+  int n_frames;
+};
+
+/// A parameter change sent from the UI to the audio thread
+struct audio_parameter_message {
+  unsigned index;
+  float value;
+};
+
+/// A value going linearly to its target over a number of frames, to avoid zipper noise 
+/// when a parameter changes
+struct smoothed_value {
+  
+  smoothed_value(float v = 0) : current{v}, target{v} {}
+  
+  void set_target(float t, int ramp_frames) {
+    target = t;
+    remaining = ramp_frames;
+    if (remaining <= 0)
+      current = target;
+    else
+      step = (target - current) / remaining;
+  }
+  
+  /// Advance by one frame
+  float next() {
+    if (remaining > 0) {
+      current = --remaining ? current + step : target;
+    }
+    return current;
+  }
+  
+  float value() const { return current; }
+  
+  bool is_ramping() const { return remaining > 0; }
+  
+  private : 
+  
+  float current, target, step = 0;
+  int remaining = 0;
+};
+
+/// A snapshot of the timing of the audio callback.
+/// The load of a callback is the time it took divided by the duration of the audio it rendered.
+struct audio_load_stats {
+  
+  static constexpr int histogram_size = 11;
+  
+  float load = 0;
+  /// Exponential moving average of the load
+  float average_load = 0;
+  float peak_load = 0;
+  std::uint64_t num_callbacks = 0;
+  /// Callbacks which took longer than the audio they rendered
+  std::uint64_t num_overruns = 0;
+  /// Callbacks which came more than two buffers after the previous one, 
+  /// which usually means the device ran out of audio
+  std::uint64_t num_xruns = 0;
+  /// histogram[k] counts the callbacks with a load in [k / 10, (k + 1) / 10),
+  /// the last bin also counts every bigger load
+  std::array<std::uint32_t, histogram_size> histogram {};
+  int buffer_size = 0;
+  float sample_rate = 0;
+};
+
+/// An audio renderer for T, which must define either render_audio(audio_output_stream&),
+/// to render interleaved frames, or render_audio(audio_block&), to render a block of planar 
+/// channels, which the renderer interleaves into the output of the device.
+/// To process captured audio, render_audio can also take a const audio_input_stream& 
+/// as first argument, eg. render_audio(const audio_input_stream&, audio_output_stream&).
+/// The scratch() arena can be used in render_audio for temporary buffers, it is reset
+/// before each call. Its alloc returns an empty span when the reserved size is exhausted,
+/// so reserve it with reserve_scratch_blocks, from the size of the blocks of the device.
+/// Independent work (eg. voices) can be split over several cores with workers().parallel_for,
+/// once the pool is started with start_workers.
+/// Every callback is timed, load_stats() gives the statistics of the callbacks to the UI.
+/// If T defines on_parameter(audio_parameter_message), the parameters changed with send_parameter
+/// are given to it in the audio thread before each call to render_audio, with their latest value.
 template <class T>
 struct audio_renderer 
 {
@@ -105,17 +619,59 @@ struct audio_renderer
   
   // In hertz
   float samplerate() const {
-    return device.sampleRate;
+    return offline_rate ? offline_rate : device.sampleRate;
+  }
+  
+  /// The format the device was opened with. The sample rate, buffer size and number of channels
+  /// are the ones the device agreed to, not necessarily the requested ones.
+  audio_buffer_format format() const {
+    return current_format;
+  }
+  
+  /// The time between a frame being rendered and being heard, as reported by the backend, in seconds
+  float output_latency() const {
+    if (!is_initialized() || !device.playback.internalSampleRate)
+      return 0;
+    return (float)device.playback.internalPeriodSizeInFrames * device.playback.internalPeriods 
+           / device.playback.internalSampleRate;
+  }
+  
+  /// True if miniaudio converts the sample rate, because the device doesn't run at the rate requested
+  bool is_resampling() const {
+    return is_initialized() && device.playback.internalSampleRate != device.sampleRate;
+  }
+  
+  bool is_initialized() const {
+    return device.pContext != nullptr && ma_device_get_state(&device) != ma_device_state_uninitialized;
   }
   
   void start_audio_render(audio_buffer_format fmt = {})
   {
-    start_audio_device(fmt, device_index);
+    init_audio_device(fmt, device_index);
+    ma_device_start(&device);
+  }
+  
+  /// Open the device without starting to render, eg. to know its sample rate beforehand
+  void init_audio_render(audio_buffer_format fmt = {})
+  {
+    init_audio_device(fmt, device_index);
+  }
+  
+  /// Start rendering on the device opened by init_audio_render, or stopped by stop_audio_render
+  void resume_audio_render()
+  {
+    if (is_initialized() && !is_rendering())
+      ma_device_start(&device);
   }
 
+  /// Capture audio without any output. 
+  /// If fmt.num_input_channels is 0, num_channels is used for the input.
   void start_audio_input(audio_buffer_format fmt)
   {
-    start_audio_device(fmt, device_index, true);
+    if (!fmt.num_input_channels)
+      fmt.num_input_channels = fmt.num_channels;
+    init_audio_device(fmt, device_index, true);
+    ma_device_start(&device);
   }
 
   void stop_audio_render()
@@ -130,12 +686,147 @@ struct audio_renderer
   
   void set_audio_device(int id) {
     stop_audio_render();
-    start_audio_device(current_format, id);
+    init_audio_device(requested_format, id, capture_only);
+    ma_device_start(&device);
   }
   
   int current_device_index() const {
     return device_index;
   }
+  
+  /// Select the capture device, among audio_input_devices()
+  void set_audio_input_device(int id) {
+    input_device_index = id;
+    if (!is_initialized() || (!capture_only && !requested_format.num_input_channels))
+      return;
+    stop_audio_render();
+    init_audio_device(requested_format, device_index, capture_only);
+    ma_device_start(&device);
+  }
+  
+  int current_input_device_index() const {
+    return input_device_index;
+  }
+  
+  /// Start num_workers realtime threads for parallel_for. Must not be called while rendering.
+  void start_workers(unsigned num_workers = std::max(std::thread::hardware_concurrency(), 1u) - 1) {
+    worker_pool.start(num_workers);
+  }
+  
+  /// Audio thread only
+  audio_worker_pool& workers() {
+    return worker_pool;
+  }
+  
+  /// Audio thread only
+  audio_scratch& scratch() {
+    return scratch_arena;
+  }
+  
+  /// Reserve num_floats in the scratch arena. Must not be called while rendering.
+  void reserve_scratch(std::size_t num_floats) {
+    scratch_floats = num_floats;
+    scratch_arena.reserve(num_floats);
+  }
+  
+  /// Reserve room in the scratch arena for num_blocks copies of the rendered block, with all 
+  /// its channels. The size is computed from the format of the device when the renderer starts. 
+  /// Must not be called while rendering.
+  void reserve_scratch_blocks(std::size_t num_blocks) {
+    scratch_blocks = num_blocks;
+    if (block.capacity())
+      reserve_scratch_for_block();
+  }
+  
+  /// The load statistics of the audio callback, can be called from any thread but the audio thread
+  audio_load_stats load_stats() {
+    std::lock_guard lock {stats_read_mutex};
+    return shared_stats.read();
+  }
+  
+  void reset_load_stats() {
+    stats_reset_request = true;
+  }
+  
+  /// Render num_frames without any device, as fast as possible, in blocks of fmt.buffer_size frames, 
+  /// and give each rendered block, interleaved, to consumer.
+  /// A sample rate of 0 means 48000 here, and there is no captured audio.
+  /// Must not be called while rendering on a device.
+  template <class Consumer>
+  void render_offline(std::uint64_t num_frames, audio_buffer_format fmt, Consumer&& consumer)
+  {
+    assert( !(is_initialized() && is_rendering()) && "render_offline called while rendering on a device" );
+    if (!fmt.sample_rate)
+      fmt.sample_rate = 48000;
+    if (!fmt.buffer_size)
+      fmt.buffer_size = 512;
+    fmt.num_input_channels = 0;
+    
+    // the format and the block of the device are restored at the end, for resume_audio_render
+    auto device_format = current_format;
+    auto device_channels = block.num_channels();
+    auto device_frames = block.capacity();
+    
+    offline_rate = fmt.sample_rate;
+    current_format = fmt;
+    block.resize(fmt.num_channels, fmt.buffer_size);
+    reserve_scratch_for_block();
+    
+    std::vector<float> buffer(fmt.buffer_size * fmt.num_channels);
+    for (std::uint64_t done = 0; done < num_frames; ) {
+      int frames = std::min<std::uint64_t>(fmt.buffer_size, num_frames - done);
+      auto out = std::span{buffer}.first(frames * fmt.num_channels);
+      std::ranges::fill(out, 0.f);
+      process({nullptr, 0, frames}, {out.data(), fmt.num_channels, frames});
+      consumer(std::span<const float>{out});
+      done += frames;
+    }
+    offline_rate = 0;
+    current_format = device_format;
+    block.resize(device_channels, device_frames);
+  }
+  
+  /// Render num_frames offline into a buffer
+  audio_buffer render_offline(std::uint64_t num_frames, audio_buffer_format fmt = {}) 
+  {
+    audio_buffer res;
+    res.num_channels = fmt.num_channels;
+    res.reserve(num_frames * fmt.num_channels);
+    render_offline(num_frames, fmt, [&res] (std::span<const float> block) {
+      res.insert(res.end(), block.begin(), block.end());
+    });
+    return res;
+  }
+  
+  /// Render num_frames offline into a WAV file
+  bool render_offline(const std::string& path, std::uint64_t num_frames, audio_buffer_format fmt = {}) 
+  {
+    audio_file_writer writer;
+    if (!writer.open(path, fmt.num_channels, fmt.sample_rate ? fmt.sample_rate : 48000))
+      return false;
+    bool ok = true;
+    render_offline(num_frames, fmt, [&writer, &ok, nc = fmt.num_channels] (std::span<const float> block) {
+      ok = ok && writer.write(block) == block.size() / (std::size_t)nc;
+    });
+    return writer.close() && ok;
+  }
+  
+  static constexpr unsigned max_parameters = 256;
+  
+  /// Send a parameter change to the audio thread, without locking or allocating.
+  /// Only the latest value of a parameter is kept until the audio thread reads it, 
+  /// so a change is never lost. Returns false if index is not below max_parameters.
+  /// Must be called from a single thread, usually the UI thread.
+  bool send_parameter(unsigned index, float value) {
+    assert( index < max_parameters && "parameter index out of range" );
+    if (index >= max_parameters)
+      return false;
+    auto& slot = parameter_slots[index];
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.dirty.store(true, std::memory_order_release);
+    parameters_dirty.store(true, std::memory_order_release);
+    return true;
+  }
 
   ~audio_renderer() {
     if (device.pContext != nullptr) {
@@ -146,44 +837,186 @@ struct audio_renderer
 
   private :
 	
-  void start_audio_device(audio_buffer_format fmt, int id, bool is_input = false)
+  void init_audio_device(audio_buffer_format fmt, int id, bool is_input = false)
   {
     auto callback = +[] (ma_device* device, void* output, const void* input, unsigned nFrames)
     {
       auto& self = *reinterpret_cast<T*>(device->pUserData);
-      audio_output_stream ostrm
-      {
-        reinterpret_cast<float*>(output),
-        (int) device->playback.channels,
-        (int) nFrames
-      };
-    
-      self.render_audio(ostrm);
+      self.process(
+        {reinterpret_cast<const float*>(input), input ? (int) device->capture.channels : 0, (int) nFrames}, 
+        {reinterpret_cast<float*>(output), output ? (int) device->playback.channels : 0, (int) nFrames}
+      );
     };
     
     if (device.pContext && device.state.value != ma_device_state_uninitialized)
       ma_device_uninit(&device);
     
     device_index = id;
+    capture_only = is_input;
     
-    ma_device_config config   = ma_device_config_init(ma_device_type_playback);
-    config.playback.pDeviceID = &audio_output_devices()[id].device->id;
+    auto type = is_input ? ma_device_type_capture
+              : fmt.num_input_channels ? ma_device_type_duplex : ma_device_type_playback;
+    
+    ma_device_config config   = ma_device_config_init(type);
+    if (type != ma_device_type_capture)
+      config.playback.pDeviceID = &audio_output_devices()[id].device->id;
+    if (type != ma_device_type_playback) {
+      config.capture.pDeviceID = &audio_input_devices()[input_device_index].device->id;
+      config.capture.format    = ma_format_f32;
+      config.capture.channels  = fmt.num_input_channels;
+    }
     config.playback.format    = ma_format_f32;   // Set to ma_format_unknown to use the device's native format.
     config.playback.channels  = fmt.num_channels;  // Set to 0 to use the device's native channel count.
-    config.sampleRate         = 44100;           // Set to 0 to use the device's native sample rate.
+    config.sampleRate         = fmt.sample_rate;  // 0 to use the device's native sample rate.
     config.dataCallback       = callback;   // This function will be called when miniaudio needs more data.
     config.periodSizeInFrames = fmt.buffer_size;
+    config.performanceProfile = fmt.low_latency ? ma_performance_profile_low_latency 
+                                                : ma_performance_profile_conservative;
     config.pUserData          = static_cast<T*>(this);   // Can be accessed from the device object (device.pUserData).
     
     if (ma_device_init(impl::audio_context(), &config, &device) != MA_SUCCESS)
         assert(false);
     
-    ma_device_start(&device);
+    // Store what the device actually agreed to
+    requested_format = fmt;
+    current_format = fmt;
+    current_format.sample_rate = device.sampleRate;
+    if (type == ma_device_type_capture) {
+      current_format.buffer_size = device.capture.internalPeriodSizeInFrames;
+      current_format.num_channels = 0;
+    }
+    else {
+      current_format.buffer_size = device.playback.internalPeriodSizeInFrames;
+      current_format.num_channels = device.playback.channels;
+    }
+    current_format.num_input_channels = (type != ma_device_type_playback) ? device.capture.channels : 0;
+    
+    block.resize(current_format.num_channels, std::max<int>(current_format.buffer_size, 64));
+    reserve_scratch_for_block();
+  }
+  
+  // Not realtime safe : grows the scratch arena for the size of the block
+  void reserve_scratch_for_block() {
+    auto per_block = block.num_channels() * impl::aligned_count(block.capacity());
+    auto n = std::max(scratch_floats, scratch_blocks * per_block);
+    if (scratch_arena.capacity() < n)
+      scratch_arena.reserve(n);
   }
 
+  // Audio thread : render one callback
+  void process(audio_input_stream istrm, audio_output_stream ostrm)
+  {
+    auto& self = static_cast<T&>(*this);
+    auto start_time = std::chrono::steady_clock::now();
+    
+    if constexpr ( requires { self.on_parameter(audio_parameter_message{}); } ) {
+      if (parameters_dirty.exchange(false, std::memory_order_acquire)) {
+        for (unsigned k = 0; k < max_parameters; ++k)
+          if (parameter_slots[k].dirty.exchange(false, std::memory_order_acquire))
+            self.on_parameter({k, parameter_slots[k].value.load(std::memory_order_relaxed)});
+      }
+    }
+    
+    constexpr bool block_input = requires { self.render_audio(istrm, block); };
+    if constexpr ( block_input || requires { self.render_audio(block); } ) {
+      // The device may ask for more frames than the period size
+      for (int offset = 0; offset < ostrm.n_frames; offset += block.capacity()) {
+        block.set_num_frames( std::min(block.capacity(), ostrm.n_frames - offset) );
+        block.clear();
+        scratch_arena.reset();
+        if constexpr (block_input) {
+          auto in = istrm.subrange(offset, block.num_frames());
+          self.render_audio(in, block);
+        }
+        else
+          self.render_audio(block);
+        if (ostrm.ptr)
+          dsp::interleave(block, ostrm.ptr + offset * ostrm.n_channels);
+      }
+    }
+    else if constexpr ( requires { self.render_audio(istrm, ostrm); } ) {
+      scratch_arena.reset();
+      self.render_audio(istrm, ostrm);
+    }
+    else {
+      scratch_arena.reset();
+      self.render_audio(ostrm);
+    }
+    
+    record_load(start_time, ostrm.n_frames);
+  }
+  
+  // Audio thread : update the statistics with the timing of a callback, and publish them
+  void record_load(std::chrono::steady_clock::time_point start, unsigned num_frames) 
+  {
+    using namespace std::chrono;
+    auto& s = stats;
+    if (stats_reset_request.exchange(false, std::memory_order_relaxed))
+      s = {};
+    
+    auto budget = duration<double>(num_frames / (double)samplerate());
+    auto load = (float)(duration<double>(steady_clock::now() - start) / budget);
+    
+    if (s.num_callbacks && start - last_callback_start > 2 * last_budget)
+      ++s.num_xruns;
+    last_callback_start = start;
+    last_budget = budget;
+    
+    s.load = load;
+    s.average_load = s.num_callbacks ? s.average_load + 0.05f * (load - s.average_load) : load;
+    s.peak_load = std::max(s.peak_load, load);
+    ++s.num_callbacks;
+    if (load > 1)
+      ++s.num_overruns;
+    ++s.histogram[std::min<int>(load * 10, audio_load_stats::histogram_size - 1)];
+    s.buffer_size = num_frames;
+    s.sample_rate = samplerate();
+    shared_stats.publish(s);
+  }
+  
   ma_device device;
+  audio_buffer_format requested_format;
   audio_buffer_format current_format;
   int device_index = 0;
+  int input_device_index = 0;
+  bool capture_only = false;
+  // not 0 while rendering offline
+  float offline_rate = 0;
+  struct parameter_slot {
+    std::atomic<float> value = 0;
+    std::atomic<bool> dirty = false;
+  };
+  
+  // the latest value of every parameter, and whether the audio thread has read it
+  std::array<parameter_slot, max_parameters> parameter_slots;
+  std::atomic<bool> parameters_dirty = false;
+  audio_block block;
+  audio_scratch scratch_arena;
+  audio_worker_pool worker_pool;
+  
+  // owned by the audio thread
+  audio_load_stats stats;
+  std::chrono::steady_clock::time_point last_callback_start;
+  std::chrono::duration<double> last_budget {0};
+  
+  realtime_shared<audio_load_stats> shared_stats;
+  std::mutex stats_read_mutex;
+  std::atomic<bool> stats_reset_request = false;
+  std::size_t scratch_floats = 1 << 16;
+  std::size_t scratch_blocks = 0;
 };
 
+/// A lens for a parameter of an audio_renderer : reads the value from the state, 
+/// and writes it both in the state and to the audio thread with send_parameter
+template <class Fn>
+auto audio_parameter(Fn member, unsigned index) {
+  return lens_readwrite{ 
+    invocable_wrapper<Fn>{member}, 
+    [member, index] (auto& state, float val) {
+      std::invoke(member, state) = val;
+      state.send_parameter(index, val);
+    }
+  };
+}
+
 } // weave
\ No newline at end of file
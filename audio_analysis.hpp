@@ -0,0 +1,222 @@
+#pragma once
+
+#include <util/spsc_queue.hpp>
+#include <audio_block.hpp>
+
+#include <vector>
+#include <span>
+#include <cmath>
+#include <numbers>
+#include <algorithm>
+#include <cassert>
+#include <bit>
+#include <atomic>
+
+namespace weave {
+
+/// Recent samples of the audio thread, for scopes and analyzers in the UI thread.
+/// The audio thread writes with push without ever waiting. The reader only gets the most
+/// recent samples : older ones are dropped when it falls behind. There must be only one reader.
+struct audio_tap {
+  
+  audio_tap(std::size_t capacity = 1 << 15) : ring{capacity} {}
+  
+  /// Audio thread
+  void push(std::span<const float> samples) {
+    if (ring.write(samples) < samples.size())
+      overflowed.store(true, std::memory_order_relaxed);
+  }
+  
+  /// Audio thread : push the average of the channels of interleaved frames
+  void push_frames(std::span<const float> frames, int num_channels) {
+    if (num_channels == 1)
+      return push(frames);
+    float mixed[256];
+    auto num_frames = frames.size() / num_channels;
+    for (std::size_t f = 0; f < num_frames; f += std::size(mixed)) {
+      auto n = std::min(std::size(mixed), num_frames - f);
+      for (std::size_t i = 0; i < n; ++i) {
+        float acc = 0;
+        for (int c = 0; c < num_channels; ++c)
+          acc += frames[(f + i) * num_channels + c];
+        mixed[i] = acc / num_channels;
+      }
+      push(std::span{mixed, n});
+    }
+  }
+  
+  /// Audio thread : push the average of the channels of a block
+  void push(const audio_block& block) {
+    float mixed[256];
+    for (int f = 0; f < block.num_frames(); f += std::size(mixed)) {
+      auto n = std::min<int>(std::size(mixed), block.num_frames() - f);
+      std::fill_n(mixed, n, 0.f);
+      for (int c = 0; c < block.num_channels(); ++c)
+        dsp::mix(std::span{mixed, (std::size_t)n}, block.channel(c).subspan(f, n), 1.f / block.num_channels());
+      push(std::span{mixed, (std::size_t)n});
+    }
+  }
+  
+  /// UI thread, returns the number of samples read.
+  /// Only the out.size() most recent samples are read, the older ones are dropped.
+  std::size_t read(std::span<float> out) {
+    // The ring filled up while the reader was behind, so it holds the oldest samples
+    // and the audio thread dropped the new ones : they're all stale
+    if (overflowed.exchange(false, std::memory_order_relaxed))
+      ring.discard_until(ring.write_position());
+    auto end = ring.write_position();
+    if (end - ring.read_position() > out.size())
+      ring.discard_until(end - out.size());
+    return ring.read(out);
+  }
+  
+  std::size_t available() const { return ring.available(); }
+  
+  private :
+  
+  spsc_ring_buffer<float> ring;
+  std::atomic<bool> overflowed = false;
+};
+
+/// An in place radix 2 FFT on separate arrays of real and imaginary parts.
+/// The twiddle factors of each stage are contiguous, so the butterflies of a stage
+/// are a loop over contiguous arrays which the compiler can vectorize.
+struct fft {
+  
+  explicit fft(std::size_t size = 1024) { resize(size); }
+  
+  void resize(std::size_t n) {
+    assert( std::has_single_bit(n) && "fft size must be a power of two" );
+    n_v = n;
+    bit_reverse.resize(n);
+    auto bits = std::countr_zero(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      std::size_t r = 0;
+      for (int b = 0; b < bits; ++b)
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      bit_reverse[i] = r;
+    }
+    // for the stage of length len, the half = len / 2 twiddles start at half - 1
+    twiddle_re.resize(n > 1 ? n - 1 : 0);
+    twiddle_im.resize(n > 1 ? n - 1 : 0);
+    for (std::size_t half = 1; half < n; half *= 2)
+      for (std::size_t k = 0; k < half; ++k) {
+        auto angle = -std::numbers::pi * k / half;
+        twiddle_re[half - 1 + k] = std::cos(angle);
+        twiddle_im[half - 1 + k] = std::sin(angle);
+      }
+  }
+  
+  std::size_t size() const { return n_v; }
+  
+  void forward(std::span<float> re, std::span<float> im) const {
+    assert( re.size() == n_v && im.size() == n_v );
+    for (std::size_t i = 0; i < n_v; ++i) {
+      auto j = bit_reverse[i];
+      if (i < j) {
+        std::swap(re[i], re[j]);
+        std::swap(im[i], im[j]);
+      }
+    }
+    for (std::size_t half = 1; half < n_v; half *= 2) {
+      auto* wr = twiddle_re.data() + half - 1;
+      auto* wi = twiddle_im.data() + half - 1;
+      for (std::size_t i = 0; i < n_v; i += 2 * half) {
+        auto* __restrict ar = re.data() + i;
+        auto* __restrict ai = im.data() + i;
+        auto* __restrict br = re.data() + i + half;
+        auto* __restrict bi = im.data() + i + half;
+        for (std::size_t k = 0; k < half; ++k) {
+          auto tr = br[k] * wr[k] - bi[k] * wi[k];
+          auto ti = br[k] * wi[k] + bi[k] * wr[k];
+          br[k] = ar[k] - tr;
+          bi[k] = ai[k] - ti;
+          ar[k] += tr;
+          ai[k] += ti;
+        }
+      }
+    }
+  }
+  
+  private :
+  
+  std::size_t n_v = 0;
+  std::vector<std::size_t> bit_reverse;
+  std::vector<float> twiddle_re, twiddle_im;
+};
+
+/// The magnitude spectrum of a stream of samples, in decibels.
+/// Frames of fft_size samples windowed with a Hann window are analyzed every hop samples,
+/// and successive spectra are averaged exponentially.
+struct spectrum_analyzer {
+  
+  spectrum_analyzer(std::size_t fft_size = 2048, std::size_t hop = 512, float averaging = 0.7f)
+  : transform{fft_size}, hop{hop}, averaging{averaging}
+  {
+    history.assign(fft_size, 0.f);
+    window.resize(fft_size);
+    for (std::size_t i = 0; i < fft_size; ++i)
+      window[i] = 0.5f - 0.5f * std::cos(2 * std::numbers::pi * i / fft_size);
+    float window_sum = 0;
+    for (auto w : window)
+      window_sum += w;
+    // so that a full scale sine reads 0 dB
+    normalization = 2 / window_sum;
+    re.resize(fft_size);
+    im.resize(fft_size);
+    magnitudes_db.assign(fft_size / 2, min_db);
+  }
+  
+  static constexpr float min_db = -120;
+  
+  std::size_t fft_size() const { return transform.size(); }
+  
+  /// The frequency of a bin, in hertz
+  float bin_frequency(std::size_t bin, float sample_rate) const {
+    return bin * sample_rate / fft_size();
+  }
+  
+  void feed(std::span<const float> samples) {
+    for (auto v : samples) {
+      history[write_pos] = v;
+      write_pos = (write_pos + 1) & (fft_size() - 1);
+      if (++since_last_frame == hop) {
+        since_last_frame = 0;
+        analyze();
+      }
+    }
+  }
+  
+  /// fft_size / 2 values, in decibels
+  std::span<const float> magnitudes() const { return magnitudes_db; }
+  
+  /// Incremented every time a frame is analyzed
+  unsigned version() const { return version_v; }
+  
+  private :
+  
+  void analyze() {
+    auto n = fft_size();
+    for (std::size_t i = 0; i < n; ++i)
+      re[i] = history[(write_pos + i) & (n - 1)] * window[i];
+    std::ranges::fill(im, 0.f);
+    transform.forward(re, im);
+    for (std::size_t k = 0; k < n / 2; ++k) {
+      auto mag = std::sqrt(re[k] * re[k] + im[k] * im[k]) * normalization;
+      auto db = std::max(min_db, 20 * std::log10(std::max(mag, 1e-9f)));
+      magnitudes_db[k] = averaging * magnitudes_db[k] + (1 - averaging) * db;
+    }
+    ++version_v;
+  }
+  
+  fft transform;
+  std::size_t hop;
+  float averaging;
+  float normalization;
+  std::vector<float> history, window, re, im, magnitudes_db;
+  std::size_t write_pos = 0;
+  std::size_t since_last_frame = 0;
+  unsigned version_v = 0;
+};
+
+} // weave
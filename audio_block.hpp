@@ -0,0 +1,227 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <memory>
+#include <cmath>
+#include <cassert>
+#include <cstdint>
+#include <numbers>
+#include <algorithm>
+
+namespace weave {
+
+/// Alignment in bytes of the channels of an audio_block and of the allocations of an audio_scratch
+inline constexpr std::size_t audio_alignment = 64;
+
+namespace impl {
+  
+  /// A float array aligned on audio_alignment
+  struct aligned_floats {
+    
+    aligned_floats() = default;
+    // Note : moving the vector keeps its data where it is, but a copy wouldn't
+    aligned_floats(aligned_floats&&) = default;
+    aligned_floats& operator=(aligned_floats&&) = default;
+    
+    void resize(std::size_t n) {
+      storage.assign(n + audio_alignment / sizeof(float), 0.f);
+      void* p = storage.data();
+      auto space = storage.size() * sizeof(float);
+      std::align(audio_alignment, n * sizeof(float), p, space);
+      ptr = static_cast<float*>(p);
+      count = n;
+    }
+    
+    float* data() const { return ptr; }
+    std::size_t size() const { return count; }
+    
+    private :
+    
+    std::vector<float> storage;
+    float* ptr = nullptr;
+    std::size_t count = 0;
+  };
+  
+  constexpr std::size_t aligned_count(std::size_t n) {
+    constexpr auto k = audio_alignment / sizeof(float);
+    return (n + k - 1) / k * k;
+  }
+}
+
+/// A planar (non interleaved) audio buffer : each channel is a contiguous, aligned array of floats,
+/// so that processing a channel is a loop that the compiler can vectorize.
+struct audio_block {
+  
+  /// Not realtime safe, allocates
+  void resize(int num_channels, int max_frames) {
+    n_channels = num_channels;
+    stride = impl::aligned_count(max_frames);
+    capacity_v = max_frames;
+    n_frames = max_frames;
+    storage.resize(stride * num_channels);
+  }
+  
+  int num_channels() const { return n_channels; }
+  int num_frames() const { return n_frames; }
+  int capacity() const { return capacity_v; }
+  
+  /// Realtime safe, the number of frames must not be greater than the capacity
+  void set_num_frames(int n) {
+    assert( n <= capacity_v && "audio_block too small" );
+    n_frames = n;
+  }
+  
+  std::span<float> channel(int c) const {
+    assert( c < n_channels );
+    return {std::assume_aligned<audio_alignment>(storage.data() + c * stride), (std::size_t)n_frames};
+  }
+  
+  void clear() {
+    for (int c = 0; c < n_channels; ++c)
+      std::ranges::fill(channel(c), 0.f);
+  }
+  
+  private :
+  
+  impl::aligned_floats storage;
+  std::size_t stride = 0;
+  int n_channels = 0;
+  int n_frames = 0;
+  int capacity_v = 0;
+};
+
+/// A bump allocator of aligned float arrays for temporary buffers of the audio thread.
+/// Memory is reserved ahead, then alloc never allocates and reset frees everything at once.
+struct audio_scratch {
+  
+  /// Not realtime safe
+  void reserve(std::size_t num_floats) {
+    storage.resize(num_floats);
+    used = 0;
+  }
+  
+  /// The content of the returned span is unspecified.
+  /// If the arena is exhausted, the span is empty, and callers must skip their processing.
+  /// Note : it doesn't assert, since it's called from the audio callback
+  std::span<float> alloc(std::size_t n) {
+    if (used + n > storage.size())
+      return {};
+    auto res = std::span<float>{storage.data() + used, n};
+    used = std::min(used + impl::aligned_count(n), storage.size());
+    return res;
+  }
+  
+  void reset() { used = 0; }
+  
+  std::size_t capacity() const { return storage.size(); }
+  
+  private :
+  
+  impl::aligned_floats storage;
+  std::size_t used = 0;
+};
+
+/// Helpers working on whole blocks of samples.
+/// They are written as simple loops over contiguous spans that the compiler can vectorize.
+namespace dsp {
+  
+  inline void gain(std::span<float> x, float g) {
+    for (auto& v : x)
+      v *= g;
+  }
+  
+  /// Gain going linearly from g0 to g1 over the block, to change a gain without clicks
+  inline void gain_ramp(std::span<float> x, float g0, float g1) {
+    auto step = x.empty() ? 0.f : (g1 - g0) / x.size();
+    for (std::size_t i = 0; i < x.size(); ++i)
+      x[i] *= g0 + i * step;
+  }
+  
+  /// dst += g * src
+  inline void mix(std::span<float> dst, std::span<const float> src, float g = 1) {
+    assert( dst.size() == src.size() );
+    auto* __restrict d = dst.data();
+    auto* __restrict s = src.data();
+    for (std::size_t i = 0; i < dst.size(); ++i)
+      d[i] += g * s[i];
+  }
+  
+  inline void mix(audio_block& dst, const audio_block& src, float g = 1) {
+    for (int c = 0; c < std::min(dst.num_channels(), src.num_channels()); ++c)
+      mix(dst.channel(c), src.channel(c), g);
+  }
+  
+  /// Write the channels of the block interleaved into out, which must hold num_frames * num_channels floats
+  inline void interleave(const audio_block& in, float* out) {
+    auto nc = in.num_channels();
+    auto nf = in.num_frames();
+    if (nc == 2) {
+      auto l = in.channel(0).data();
+      auto r = in.channel(1).data();
+      for (int i = 0; i < nf; ++i) {
+        out[2 * i] = l[i];
+        out[2 * i + 1] = r[i];
+      }
+      return;
+    }
+    for (int c = 0; c < nc; ++c) {
+      auto src = in.channel(c).data();
+      for (int i = 0; i < nf; ++i)
+        out[i * nc + c] = src[i];
+    }
+  }
+  
+  /// Read num_frames interleaved frames of in into the channels of the block
+  inline void deinterleave(const float* in, audio_block& out) {
+    auto nc = out.num_channels();
+    auto nf = out.num_frames();
+    if (nc == 2) {
+      auto l = out.channel(0).data();
+      auto r = out.channel(1).data();
+      for (int i = 0; i < nf; ++i) {
+        l[i] = in[2 * i];
+        r[i] = in[2 * i + 1];
+      }
+      return;
+    }
+    for (int c = 0; c < nc; ++c) {
+      auto dst = out.channel(c).data();
+      for (int i = 0; i < nf; ++i)
+        dst[i] = in[i * nc + c];
+    }
+  }
+  
+  /// sin(x) for any x, with an error below 1e-4, and without branches
+  inline float fast_sin(float x) {
+    constexpr float pi = std::numbers::pi_v<float>;
+    // wrap to [-pi, pi]
+    x -= 2 * pi * std::nearbyint(x * (0.5f / pi));
+    // fold to [-pi/2, pi/2], where sin is symmetric around pi/2
+    auto a = std::abs(x);
+    x = std::copysign(std::min(a, pi - a), x);
+    auto x2 = x * x;
+    return x * (1.f + x2 * (-1.6666667e-1f + x2 * (8.3333310e-3f + x2 * (-1.9840874e-4f + x2 * 2.7525562e-6f))));
+  }
+  
+  /// out[i] = sin(2 * pi * phase[i])
+  inline void sin_2pi(std::span<const float> phase, std::span<float> out) {
+    assert( phase.size() == out.size() );
+    constexpr float two_pi = 2 * std::numbers::pi_v<float>;
+    for (std::size_t i = 0; i < out.size(); ++i)
+      out[i] = fast_sin(two_pi * phase[i]);
+  }
+  
+  /// Fill out with the phases of an oscillator starting at phase and advancing by increment
+  /// per sample, wrapped to [0, 1). Returns the phase following the last sample.
+  inline float phase_ramp(std::span<float> out, float phase, float increment) {
+    for (std::size_t i = 0; i < out.size(); ++i) {
+      auto p = phase + i * increment;
+      out[i] = p - std::floor(p);
+    }
+    auto next = phase + out.size() * increment;
+    return next - std::floor(next);
+  }
+}
+
+} // weave
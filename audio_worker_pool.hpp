@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <type_traits>
+
+namespace weave {
+
+namespace impl {
+  /// Raise the priority of a thread for realtime audio work, if the system allows it
+  void set_realtime_priority(std::thread& t);
+}
+
+/// Pre-spawned threads which help the audio thread through fork/join parallel loops.
+/// Once started, parallel_for never allocates nor locks : workers spin for a short while
+/// waiting for work, then sleep on an atomic until the next parallel_for.
+struct audio_worker_pool {
+  
+  audio_worker_pool() = default;
+  audio_worker_pool(const audio_worker_pool&) = delete;
+  audio_worker_pool& operator=(const audio_worker_pool&) = delete;
+  
+  ~audio_worker_pool() { stop(); }
+  
+  /// Spawn num_workers threads, which run along the calling thread in parallel_for.
+  /// Not realtime safe, must not be called while parallel_for runs.
+  void start(unsigned num_workers) {
+    stop();
+    quit = false;
+    finished_workers = 0;
+    // Note : the epoch is read here rather than by the threads, which may only start running
+    // after the first parallel_for, and would then miss it
+    auto first_epoch = epoch.load(std::memory_order_relaxed);
+    for (unsigned k = 0; k < num_workers; ++k) {
+      workers.emplace_back( [this, first_epoch] { worker_loop(first_epoch); } );
+      impl::set_realtime_priority(workers.back());
+    }
+  }
+  
+  void stop() {
+    if (workers.empty())
+      return;
+    quit = true;
+    epoch.fetch_add(1, std::memory_order_release);
+    epoch.notify_all();
+    for (auto& w : workers)
+      w.join();
+    workers.clear();
+  }
+  
+  unsigned num_workers() const { return workers.size(); }
+  
+  /// Call fn(i) for every i in [0, count), distributed over the workers and the calling thread,
+  /// and return once every call is done.
+  /// Only one thread (usually the audio thread) may call parallel_for.
+  template <class Fn>
+  void parallel_for(unsigned count, Fn&& fn) {
+    if (workers.empty() || count <= 1) {
+      for (unsigned i = 0; i < count; ++i)
+        fn(i);
+      return;
+    }
+    
+    // Note : fn is only referenced, which is fine since we wait for every worker below
+    job_ctx = const_cast<void*>(static_cast<const void*>(std::addressof(fn)));
+    job_fn = [] (void* ctx, unsigned i) { (*static_cast<std::remove_reference_t<Fn>*>(ctx))(i); };
+    job_count = count;
+    next_index.store(0, std::memory_order_relaxed);
+    finished_workers.store(0, std::memory_order_relaxed);
+    epoch.fetch_add(1, std::memory_order_release);
+    epoch.notify_all();
+    
+    run_tasks();
+    
+    // Every worker goes through each epoch, so that none of them is still running
+    // this job when the next one is set up
+    while (finished_workers.load(std::memory_order_acquire) != workers.size())
+      std::this_thread::yield();
+  }
+  
+  private :
+  
+  static constexpr int spin_count = 2000;
+  
+  void run_tasks() {
+    unsigned i;
+    while ((i = next_index.fetch_add(1, std::memory_order_relaxed)) < job_count)
+      job_fn(job_ctx, i);
+  }
+  
+  void worker_loop(unsigned seen) {
+    while (true) {
+      for (int k = 0; k < spin_count && epoch.load(std::memory_order_acquire) == seen; ++k)
+        ;
+      epoch.wait(seen, std::memory_order_acquire);
+      seen = epoch.load(std::memory_order_acquire);
+      if (quit.load(std::memory_order_relaxed))
+        return;
+      run_tasks();
+      finished_workers.fetch_add(1, std::memory_order_release);
+    }
+  }
+  
+  std::vector<std::thread> workers;
+  void (*job_fn)(void*, unsigned) = nullptr;
+  void* job_ctx = nullptr;
+  unsigned job_count = 0;
+  alignas(64) std::atomic<unsigned> epoch = 0;
+  alignas(64) std::atomic<unsigned> next_index = 0;
+  alignas(64) std::atomic<unsigned> finished_workers = 0;
+  std::atomic<bool> quit = false;
+};
+
+} // weave
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 namespace weave {
 
 struct app_state {
@@ -11,4 +13,68 @@ struct app_state {
   }
 };
 
+/// A value published by one thread and read by a realtime thread, using a triple buffer.
+/// publish never blocks read, and read is wait free.
+/// There must be only one publishing thread and one reading thread.
+template <class T>
+struct realtime_shared {
+  
+  realtime_shared(const T& init = {}) : buffers{init, init, init} {}
+  
+  /// Copy v so that the reader sees it on its next read
+  void publish(const T& v) {
+    buffers[back] = v;
+    back = middle.exchange(back | dirty_bit, std::memory_order_acq_rel) & index_mask;
+  }
+  
+  /// The last published value, stays valid until the next call to read
+  const T& read() {
+    if (middle.load(std::memory_order_relaxed) & dirty_bit)
+      front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+    return buffers[front];
+  }
+  
+  private :
+  
+  static constexpr unsigned dirty_bit = 4;
+  static constexpr unsigned index_mask = 3;
+  
+  T buffers[3];
+  // owned by the publisher
+  unsigned back = 0;
+  std::atomic<unsigned> middle = 1;
+  // owned by the reader
+  unsigned front = 2;
+};
+
+/// An app_state whose T part is read by a realtime thread, eg. in render_audio.
+/// Every write through the lenses is published, and the realtime thread gets
+/// the last published copy of T with realtime_read(), without ever locking.
+template <class T>
+struct realtime_app_state : T {
+  
+  void apply_write(this auto& self, auto&& fn) {
+    fn(self);
+    self.publish();
+  }
+  
+  decltype(auto) apply_read(this auto& self, auto&& fn) {
+    return (fn(self));
+  }
+  
+  /// Publish the current value of T, for writes done outside of the lenses
+  void publish() {
+    shared.publish(static_cast<const T&>(*this));
+  }
+  
+  /// Only to be called from the realtime thread
+  const T& realtime_read() {
+    return shared.read();
+  }
+  
+  private :
+  
+  realtime_shared<T> shared {static_cast<const T&>(*this)};
+};
+
 }
\ No newline at end of file
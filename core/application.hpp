@@ -26,7 +26,11 @@ struct animation_context {
   template <class T>
   T& state() { return *static_cast<T*>(state_ptr); }
   
+  /// The time elapsed since the previous call of the animation, in seconds
+  float elapsed_seconds() const { return std::chrono::duration<float>(elapsed).count(); }
+  
   void* state_ptr;
+  std::chrono::steady_clock::duration elapsed {};
 };
 
 namespace impl {
@@ -85,8 +89,8 @@ namespace impl {
       
       focused = id;
       
-      // Note : In a lot of cases we don't have to recompute the position entirely from the root
-      // but it's good to recompute it once in a while
+      // Note : the absolute offsets are cached in the tree, this is cheap 
+      // as long as the layout didn't change since the last event
       update_absolute_position(tree);
       
       top_parent_listener = {};
@@ -147,72 +151,300 @@ namespace impl {
     optional<widget_id> focused;
   };
   
-  struct widget_animations {
+  /// The set of regions of the window to be repainted on the next frame, in absolute coordinates.
+  struct damage_region {
     
-    struct animation {
+    static constexpr int max_rects = 8;
+    
+    /// Mark the whole window as damaged
+    void add_all() {
+      full = true;
+    }
+    
+    void add(rectangle r) {
+      if (full || r.empty())
+        return;
+      // Snap to the pixel grid, so that the scissors and the clears agree on the frame edges
+      auto a = point{std::floor(r.origin.x), std::floor(r.origin.y)};
+      auto b = point{std::ceil(r.origin.x + r.size.x), std::ceil(r.origin.y + r.size.y)};
+      r = rectangle{a, b - a};
       
-      // Return false if the animation should stop
-      bool run(std::chrono::steady_clock::time_point now, void* state_ptr) {
-        last_call = now;
-        return call(widget, state_ptr);
+      // Merge with every rectangle we intersect, until the set is disjoint again
+      for (auto it = rects.begin(); it != rects.end();) {
+        if (it->intersects(r)) {
+          r = r.bounding_union(*it);
+          rects.erase(it);
+          it = rects.begin();
+        }
+        else
+          ++it;
       }
+      rects.push_back(r);
       
+      if (rects.size() > max_rects) {
+        auto bounds = rects.front();
+        for (auto& e : rects)
+          bounds = bounds.bounding_union(e);
+        rects.assign(1, bounds);
+      }
+    }
+    
+    /// Clamp the damage to the window area and return the damaged rectangles.
+    /// If the whole window is damaged, this is a single rectangle of the size of the window.
+    std::span<const rectangle> resolve(point window_size) {
+      auto win = rectangle{window_size};
+      if (full)
+        rects.assign(1, win);
+      for (auto& r : rects)
+        r = r.intersection(win);
+      std::erase_if(rects, [] (auto& r) { return r.empty(); });
+      return rects;
+    }
+    
+    bool is_full() const { return full; }
+    
+    bool empty() const { return !full && rects.empty(); }
+    
+    void clear() {
+      full = false;
+      rects.clear();
+    }
+    
+    private :
+    
+    std::vector<rectangle> rects;
+    bool full = false;
+  };
+  
+  /// Invalidate the offscreen layers in which a widget is painted
+  inline void invalidate_layers_of(const widget_tree& tree, widget_ref w) {
+    if (auto* l = w.offscreen_layer())
+      l->invalidate();
+    for (auto p : tree.parents_of(w))
+      if (auto* l = p.offscreen_layer())
+        l->invalidate();
+  }
+  
+  /// Schedules the animations in a min-heap ordered by their next deadline
+  struct widget_animations {
+    
+    using clock = std::chrono::steady_clock;
+    
+    struct animation {
       widget_ref widget;
-      std::function<bool(widget_ref, void*)> call;
-      int period_in_ms;
-      std::chrono::steady_clock::time_point last_call;
+      std::function<bool(widget_ref, animation_context&)> call;
+      // zero for the animations running on every frame
+      clock::duration period;
+      clock::time_point last_call;
+      clock::time_point deadline;
+      unsigned generation = 0;
+      // position in the heap, -1 if the slot is free
+      int heap_pos = -1;
     };
     
     private :
     
-    std::vector<animation> animations;
+    // an animation waiting for its widget to be mounted
+    struct pending_animation {
+      widget_id id;
+      std::function<bool(widget_ref, animation_context&)> call;
+      clock::duration period;
+    };
+    
+    std::vector<animation> slots;
+    std::vector<unsigned> free_slots;
+    std::vector<pending_animation> pending;
+    // indexes in slots, ordered by deadline
+    std::vector<unsigned> heap;
+    clock::duration frame_period = std::chrono::milliseconds(16);
     
     public :
     
+    /// Run fn every period_ms until it returns false
     template <class Widget, class Fn>
-    void animate(Widget& widget, Fn fn, int period_ms)
+    animation_handle animate(Widget& widget, Fn fn, int period_ms)
     {
-      animations.push_back(
-          animation{
-            &widget,
-            [fn] (widget_ref w, void* state) -> bool { 
-              auto ctx = animation_context{state};
-              return fn(w.as<Widget>(), ctx); 
-            },
-            period_ms,
-            std::chrono::steady_clock::now()
-          }
-      );
+      return schedule(&widget, fn, std::chrono::milliseconds(period_ms));
+    }
+    
+    /// Run fn once per frame until it returns false, 
+    /// animation_context::elapsed gives the real time since the last call
+    template <class Widget, class Fn>
+    animation_handle animate_frames(Widget& widget, Fn fn)
+    {
+      return schedule(&widget, fn, clock::duration::zero());
+    }
+    
+    /// Like animate, but the animation starts once the widget is mounted, so that it
+    /// can be called from a build, before the widget is moved to its final place
+    template <class Widget, class Fn>
+    void animate_on_mount(Widget& widget, Fn fn, int period_ms)
+    {
+      pending.push_back({widget.id(), erase_call<Widget>(fn), std::chrono::milliseconds(period_ms)});
+    }
+    
+    template <class Widget, class Fn>
+    void animate_frames_on_mount(Widget& widget, Fn fn)
+    {
+      pending.push_back({widget.id(), erase_call<Widget>(fn), clock::duration::zero()});
+    }
+    
+    /// Start the animations of the widgets mounted since the last call.
+    /// Note : a widget built is mounted by the end of the build or the rebuild, 
+    /// so the animations of the widgets which are not in the tree are dropped
+    void start_mounted(const widget_tree& tree) {
+      for (auto& p : pending)
+        if (auto w = tree.get(p.id))
+          schedule(*w, std::move(p.call), p.period);
+      pending.clear();
+    }
+    
+    void cancel(animation_handle h) {
+      if (h.index < slots.size() && slots[h.index].generation == h.generation 
+          && slots[h.index].heap_pos >= 0)
+        remove(h.index);
     }
     
     void deanimate(widget_ref w) {
-      erase_if(animations, [w] (auto& a) { return a.widget == w;} );
+      std::erase_if(pending, [id = w.id()] (auto& p) { return p.id == id; });
+      for (unsigned k = 0; k < slots.size(); ++k)
+        if (slots[k].heap_pos >= 0 && slots[k].widget == w)
+          remove(k);
     }
-  
-    /// Return true if a repaint is needed 
-    bool run(void* state_ptr)
+    
+    void set_frame_period(clock::duration p) {
+      frame_period = p;
+    }
+    
+    /// The time at which the next animation must run, if any
+    std::optional<clock::time_point> next_deadline() const {
+      if (heap.empty())
+        return {};
+      return slots[heap[0]].deadline;
+    }
+    
+    /// Return true if a repaint is needed, the area of every widget animated 
+    /// is added to the damage
+    bool run(void* state_ptr, const widget_tree& tree, damage_region& damage)
     {
-      if (animations.size() == 0)
-        return false;
-      
-      using namespace std::chrono;
-      const auto now = steady_clock::now();
-      
+      const auto now = clock::now();
       bool gotta_repaint = false;
       
-      erase_if( animations, [now, &gotta_repaint, state_ptr] (auto& a)
+      while (heap.size() && slots[heap[0]].deadline <= now)
       {
-        const auto time_since_last = int(duration_cast<milliseconds>(now - a.last_call).count());
-        
-        if (time_since_last < a.period_in_ms)
-          return false;
-        
+        auto idx = heap[0];
+        auto& a = slots[idx];
         gotta_repaint = true;
         
-        return not a.run(now, state_ptr);
-      });
+        auto widget_area = [&] { 
+          return rectangle{a.widget.absolute_position(tree), a.widget.size()}; 
+        };
+        auto ctx = animation_context{state_ptr, now - a.last_call};
+        a.last_call = now;
+        damage.add(widget_area());
+        bool keep = a.call(a.widget, ctx);
+        damage.add(widget_area());
+        invalidate_layers_of(tree, a.widget);
+        
+        if (keep) {
+          a.deadline = now + (a.period == clock::duration::zero() ? frame_period : a.period);
+          sift_down(0);
+        }
+        else
+          remove(idx);
+      }
       return gotta_repaint;
     }
+    
+    private :
+    
+    using erased_call = std::function<bool(widget_ref, animation_context&)>;
+    
+    template <class Widget, class Fn>
+    static erased_call erase_call(Fn fn) {
+      return [fn] (widget_ref w, animation_context& ctx) -> bool { 
+        return fn(w.as<Widget>(), ctx); 
+      };
+    }
+    
+    template <class Widget, class Fn>
+    animation_handle schedule(Widget* widget, Fn fn, clock::duration period)
+    {
+      return schedule(widget_ref(widget), erase_call<Widget>(fn), period);
+    }
+    
+    animation_handle schedule(widget_ref widget, erased_call call, clock::duration period)
+    {
+      unsigned idx;
+      if (free_slots.size()) {
+        idx = free_slots.back();
+        free_slots.pop_back();
+      }
+      else {
+        idx = slots.size();
+        slots.emplace_back();
+      }
+      
+      auto now = clock::now();
+      auto& a = slots[idx];
+      a.widget = widget;
+      a.call = std::move(call);
+      a.period = period;
+      a.last_call = now;
+      a.deadline = now + (period == clock::duration::zero() ? frame_period : period);
+      a.heap_pos = heap.size();
+      heap.push_back(idx);
+      sift_up(a.heap_pos);
+      return {idx, a.generation};
+    }
+    
+    void remove(unsigned idx) {
+      auto pos = slots[idx].heap_pos;
+      assert( pos >= 0 && "removing an animation which isn't scheduled" );
+      swap_nodes(pos, heap.size() - 1);
+      heap.pop_back();
+      if (pos < (int)heap.size()) {
+        auto moved = heap[pos];
+        sift_up(pos);
+        sift_down(slots[moved].heap_pos);
+      }
+      auto& a = slots[idx];
+      a.heap_pos = -1;
+      a.call = {};
+      ++a.generation;
+      free_slots.push_back(idx);
+    }
+    
+    bool before(int i, int j) const {
+      return slots[heap[i]].deadline < slots[heap[j]].deadline;
+    }
+    
+    void swap_nodes(int i, int j) {
+      std::swap(heap[i], heap[j]);
+      slots[heap[i]].heap_pos = i;
+      slots[heap[j]].heap_pos = j;
+    }
+    
+    void sift_up(int i) {
+      while (i > 0 && before(i, (i - 1) / 2)) {
+        swap_nodes(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+      }
+    }
+    
+    void sift_down(int i) {
+      const int n = heap.size();
+      while (true) {
+        int m = i;
+        for (int c = 2 * i + 1; c <= 2 * i + 2 && c < n; ++c)
+          if (before(c, m))
+            m = c;
+        if (m == i)
+          return;
+        swap_nodes(i, m);
+        i = m;
+      }
+    }
   };
 } // impl
 
@@ -256,14 +488,19 @@ struct application_context {
   
   template <class RootCtor>
   application_context(window_properties win_prop, RootCtor Ctor)
-  : backend{this},
+  : backend{this, win_prop.headless},
     win{win_prop},
+    gctx{win_prop.headless ? render_backend::software : render_backend::opengl,
+         vec2i{(int)win_prop.size.x, (int)win_prop.size.y}},
     root{Ctor()},
     mouse{root.id()}
   {
     backend.start_text_input(win);
     root.mount(tree, root.id());
+    animations.start_mounted(tree);
     layout_root();
+    auto rate = win.refresh_rate();
+    set_frame_rate(rate > 0 ? rate : 60);
   }
   
   widget_ref root_widget() const {
@@ -271,8 +508,28 @@ struct application_context {
   }
   
   template <class W, class Fn>
-  void animate(W& widget, Fn fn, int period_in_ms) {
-    animations.animate(widget, fn, period_in_ms);
+  animation_handle animate(W& widget, Fn fn, int period_in_ms) {
+    return animations.animate(widget, fn, period_in_ms);
+  }
+  
+  template <class W, class Fn>
+  animation_handle animate_frames(W& widget, Fn fn) {
+    return animations.animate_frames(widget, fn);
+  }
+  
+  /// Animate a widget from its build, see impl::widget_animations::animate_on_mount
+  template <class W, class Fn>
+  void animate_on_mount(W& widget, Fn fn, int period_in_ms) {
+    animations.animate_on_mount(widget, fn, period_in_ms);
+  }
+  
+  template <class W, class Fn>
+  void animate_frames_on_mount(W& widget, Fn fn) {
+    animations.animate_frames_on_mount(widget, fn);
+  }
+  
+  void cancel_animation(animation_handle h) {
+    animations.cancel(h);
   }
   
   void deanimate(widget_ref r) {
@@ -288,6 +545,7 @@ struct application_context {
     overlays.push_back(std::move(w));
     auto& o = overlays.back();
     o.mount(widget_tree(), o.id());
+    animations.start_mounted(widget_tree());
     mouse.set_focused(o.id(), widget_tree());
     return o.borrow();
   }
@@ -344,42 +602,143 @@ struct application_context {
     return win;
   }
   
+  /// Request a rebuild, also when called outside of an event, eg. during a build.
+  /// Must not be called from the audio callback, see event_context::lift_realtime_rebuild_request
   void request_rebuild() {
     rebuild_requested = true;
+    impl::sdl_backend::wake_up();
+  }
+  
+  /// Mark the whole window to be repainted on the next frame.
+  void invalidate() {
+    damage.add_all();
+  }
+  
+  /// Mark a region of the window, in absolute coordinates, to be repainted on the next frame.
+  void invalidate(rectangle r) {
+    damage.add(r);
+  }
+  
+  /// When enabled, only the damaged regions of the window are repainted, and only the 
+  /// widgets intersecting them are painted. 
+  void set_damage_tracking(bool enabled) {
+    damage_tracking = enabled;
+    damage.add_all();
+  }
+  
+  bool has_damage_tracking() const {
+    return damage_tracking;
+  }
+  
+  /// Register a widget painted with its children in an offscreen layer, see views::cached_layer
+  void add_offscreen_layer(widget_id id) {
+    offscreen_layers.push_back(id);
+  }
+  
+  void remove_offscreen_layer(widget_id id) {
+    std::erase(offscreen_layers, id);
+  }
+  
+  /// Mark the offscreen layers in which a widget is painted to be painted again
+  void invalidate_layers(const widget_base& w) {
+    if (offscreen_layers.size() && tree.contains(w.id()))
+      impl::invalidate_layers_of(tree, *tree.get(w.id()));
+  }
+  
+  /// Mark the offscreen layers intersecting a region, in absolute coordinates, to be painted again
+  void invalidate_layers(rectangle r) {
+    for (auto id : offscreen_layers) {
+      auto w = tree.get(id);
+      if (w && r.intersects(rectangle{w->absolute_position(tree), w->size()}))
+        w->offscreen_layer()->invalidate();
+    }
+  }
+  
+  void invalidate_layers() {
+    for (auto id : offscreen_layers)
+      if (auto w = tree.get(id))
+        w->offscreen_layer()->invalidate();
   }
   
   /// Implementation only.
   void paint() {
     painter p = graphics_context().painter();
     p.set_font("default");
-    p.begin_frame(win.size(), 1);
     
-    auto fn = [this, &p] (this auto&& self, widget_ref w, point scissor_pos, point scissor_sz) -> void
+    // A repaint without any damage reported is a repaint of the whole window
+    if (damage.empty())
+      damage.add_all();
+    
+    auto fn = [] (this auto&& self, painter& p, widget_ref w, rectangle scissor) -> void
     {
       auto pos = w.position();
-      auto sz = w.size();
-      
-      // FIXME : this is a rectangle intersection!
-      auto new_scissor_pos = max(scissor_pos, pos);
-      new_scissor_pos = min(scissor_pos + scissor_sz, new_scissor_pos);
+      auto new_scissor = scissor.intersection(w.area());
       
-      auto new_scissor_end = min(scissor_pos + scissor_sz, pos + sz);
-      auto new_scissor_sz = new_scissor_end - new_scissor_pos;
-      new_scissor_sz = max(new_scissor_sz, {0, 0});
+      // Nothing visible within the scissor : skip the widget and its children 
+      if (new_scissor.empty())
+        return;
       
       // p.stroke_style(colors::red);
-      // p.stroke_rect(new_scissor_pos, new_scissor_sz);
-      auto scissor_raii = p.scissor(new_scissor_pos, new_scissor_sz);
+      // p.stroke_rect(new_scissor.origin, new_scissor.size);
+      auto scissor_raii = p.scissor(new_scissor.origin, new_scissor.size);
       auto traii = p.translate(pos);
+      
+      // An up to date layer replaces the painting of the whole subtree
+      if (auto* layer = w.offscreen_layer(); layer && layer->is_ready(w.size())) {
+        p.draw_layer(*layer, w.size());
+        return;
+      }
+      
       w.paint(p);
       for (auto& w : w.children())
-        self(w, new_scissor_pos - pos, new_scissor_sz);
+        self(p, w, new_scissor.translated(-pos));
     };
     
-    fn(root_widget(), {0, 0}, win.size());
+    // Note : nanovg can't switch frame buffers within a frame, so the layers which were 
+    // invalidated are painted before the frame of the window begins
+    std::erase_if(offscreen_layers, [this] (widget_id id) { return !tree.contains(id); });
+    for (auto id : offscreen_layers) {
+      auto w = *tree.get(id);
+      auto* layer = w.offscreen_layer();
+      auto sz = vec2i{(int)w.size().x, (int)w.size().y};
+      // an empty layer stays dirty, and its subtree is painted directly
+      if (layer->is_ready(w.size()) || sz.x <= 0 || sz.y <= 0)
+        continue;
+      gctx.begin_layer(*layer, sz);
+      {
+        painter lp = gctx.painter();
+        lp.set_font("default");
+        auto traii = lp.translate(-w.position());
+        fn(lp, w, w.area());
+      }
+      gctx.end_layer(*layer);
+      damage.add(rectangle{w.absolute_position(tree), w.size()});
+    }
+    // Note : they're painted the same as their list, so they damage nothing
+    gctx.paint_rasterized_caches();
     
-    for (auto& o : overlays)
-      fn(o.borrow(), {0, 0}, win.size());
+    if (damage_tracking) {
+      auto sz = win.size();
+      if (!gctx.bind_retained_frame(vec2i{(int)sz.x, (int)sz.y}))
+        damage.add_all();
+    }
+    // Without the retained frame buffer, the whole frame buffer is cleared, so the whole 
+    // window must be repainted
+    else
+      damage.add_all();
+    
+    auto damaged = damage.resolve(win.size());
+    
+    if (!damage_tracking || damage.is_full())
+      p.begin_frame(win.size(), 1);
+    else
+      p.begin_partial_frame(win.size(), 1, damaged);
+    
+    for (auto& r : damaged) {
+      fn(p, root_widget(), r);
+      for (auto& o : overlays)
+        fn(p, o.borrow(), r);
+    }
     
     /*
     auto f = current_mouse_focus();
@@ -388,12 +747,16 @@ struct application_context {
     p.fill(r);*/
     
     p.end_frame();
+    if (damage_tracking)
+      gctx.present_retained_frame();
     win.swap_buffer();
+    damage.clear();
   }
   
   void on_window_resize() {
     debug_log("window resize");
     layout_root();
+    invalidate();
     paint();
   }
   
@@ -405,12 +768,24 @@ struct application_context {
     return tree;
   }
   
+  /// Set the maximum number of frames painted per second, 
+  /// by default the refresh rate of the display
+  void set_frame_rate(float fps) {
+    assert( fps > 0 && "frame rate must be positive" );
+    frame_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<float>(1.f / fps));
+    animations.set_frame_period(frame_period);
+  }
+  
   std::atomic<bool> rebuild_requested = false;
+  // rebuild_requested can be set without waking up the event loop, which then polls it
+  bool poll_rebuild_requests = false;
   
   private : 
   
   void layout_root() {
     root.layout(win.size());
+    tree.invalidate_layout();
     root.debug_dump();
     auto size_info = root_widget().size_info();
     win.set_min_size(size_info.min);
@@ -422,11 +797,16 @@ struct application_context {
   struct graphics_context gctx;
   
   struct widget_tree tree;
+  // Note : constructed before the root, whose build can animate its widgets on mount
+  impl::widget_animations animations;
   widget_box root;
   std::vector<widget_box> overlays;
   impl::mouse_event_dispatcher mouse;
   impl::keyboard_event_dispatcher keyboard;
-  impl::widget_animations animations;
+  impl::damage_region damage;
+  bool damage_tracking = false;
+  std::vector<widget_id> offscreen_layers;
+  std::chrono::steady_clock::duration frame_period;
 };
 
 namespace impl {
@@ -466,6 +846,11 @@ event_result mouse_event_dispatcher::on(mouse_event e, void* state,
   assert( focused_ref && "focused not found in the tree" );
   focused_ref->on(e, ec);
   
+  // focused::on might have moved some widgets (scrolling, etc...), in which case 
+  // it must have requested a repaint
+  if (res.repaint_requested || res.rebuild_requested)
+    ctx.widget_tree().invalidate_layout();
+  
   // focused::on might have relocated or deleted focused, look it up again
   focused_ref = ctx.widget_tree().get(focused_id);
   // We might have a new focused_id
@@ -522,9 +907,36 @@ event_result keyboard_event_dispatcher::on(keyboard_event e, void* state,
 auto event_context::lift_rebuild_request() {
   return [p = &context()] {
     p->rebuild_requested = true;
+    impl::sdl_backend::wake_up();
+  };
+}
+
+auto event_context::lift_realtime_rebuild_request() {
+  context().poll_rebuild_requests = true;
+  return [p = &context()] {
+    p->rebuild_requested.store(true, std::memory_order_release);
   };
 }
 
+void event_context::request_repaint() {
+  frame_result.repaint_requested = true;
+  ctx.invalidate();
+  ctx.invalidate_layers();
+}
+
+void event_context::request_repaint(const widget_base& w) {
+  frame_result.repaint_requested = true;
+  ctx.invalidate(rectangle{w.absolute_position(tree()), w.size()});
+  // Note : only the layers the widget is painted in, not the ones it's painted over 
+  ctx.invalidate_layers(w);
+}
+
+void event_context::request_repaint(rectangle r) {
+  frame_result.repaint_requested = true;
+  ctx.invalidate(r);
+  ctx.invalidate_layers(r);
+}
+
 void event_context::push_overlay(widget_box widget) {
   ctx.push_overlay(std::move(widget));
   request_repaint();
@@ -552,8 +964,17 @@ widget_ref event_context::current_mouse_focus() {
 }
 
 template <class W, class Fn>
-void event_context::animate(W& widget, Fn fn, int period_in_ms) {
-  ctx.animate(widget, fn, period_in_ms);
+animation_handle event_context::animate(W& widget, Fn fn, int period_in_ms) {
+  return ctx.animate(widget, fn, period_in_ms);
+}
+
+template <class W, class Fn>
+animation_handle event_context::animate_frames(W& widget, Fn fn) {
+  return ctx.animate_frames(widget, fn);
+}
+
+void event_context::cancel_animation(animation_handle h) {
+  ctx.cancel_animation(h);
 }
   
 void event_context::deanimate(widget_ref w) {
@@ -620,6 +1041,8 @@ struct application
     app_view.emplace( view_ctor(state) );
     auto bctx = build_context{app_ctx};
     app_view->rebuild(old_view, app_ctx.root_widget(), bctx, state);
+    app_ctx.animations.start_mounted(app_ctx.widget_tree());
+    app_ctx.widget_tree().invalidate_layout();
     app_ctx.mouse.update_absolute_position_after_rebuild(app_ctx.widget_tree(), 
                                                         app_ctx.root_widget().id());
     app_ctx.rebuild_requested = false;
@@ -629,27 +1052,71 @@ struct application
     app_ctx.win.set_max_size(size_info.max);
   }
   
+  /// How long the event loop can wait for events, -1 to wait until the next event
+  int wait_timeout(bool repaint_pending, std::chrono::steady_clock::time_point last_paint) const {
+    using namespace std::chrono;
+    auto deadline = app_ctx.animations.next_deadline();
+    if (repaint_pending || app_ctx.poll_rebuild_requests) {
+      auto next_frame = last_paint + app_ctx.frame_period;
+      if (!repaint_pending)
+        // Note : last_paint can be long ago while polling
+        next_frame = std::max(next_frame, steady_clock::now() + app_ctx.frame_period);
+      deadline = deadline ? std::min(*deadline, next_frame) : next_frame;
+    }
+    if (!deadline)
+      return -1;
+    return std::max(0, int(ceil<milliseconds>(*deadline - steady_clock::now()).count()));
+  }
+  
   void run(State& state)
   {
+    using namespace std::chrono;
+    auto last_paint = steady_clock::now() - app_ctx.frame_period;
+    bool repaint_pending = false;
+    
     while(!app_ctx.backend.want_quit)
     {
-      event_result frame;
-      app_ctx.backend.visit_event( [&, this] (auto&& e) {
+      // Every pending event is handled before painting. 
+      // Note : we still rebuild between two events if requested, so that the next event 
+      // isn't sent to widgets which don't reflect the state anymore
+      app_ctx.backend.visit_events( [&, this] (auto&& e) {
+        event_result frame;
         if constexpr ( std::is_same_v<std::remove_reference_t<decltype(e)>, keyboard_event> )
           frame = app_ctx.keyboard.on(e, &state, app_ctx);
         else
           frame = app_ctx.mouse.on(e, &state, app_ctx);
-      });
+        
+        if (frame.repaint_requested)
+          app_ctx.widget_tree().invalidate_layout();
+        
+        if (frame.rebuild_requested || app_ctx.rebuild_requested) {
+          rebuild(state);
+          app_ctx.invalidate();
+          frame.repaint_requested = true;
+        }
+        
+        repaint_pending = repaint_pending || frame.repaint_requested;
+      }, wait_timeout(repaint_pending, last_paint));
       
-      if (frame.rebuild_requested || app_ctx.rebuild_requested) {
+      // rebuilds can be requested from other threads
+      if (app_ctx.rebuild_requested) {
         rebuild(state);
-        frame.repaint_requested = true;
+        app_ctx.invalidate();
+        repaint_pending = true;
       }
       
-      frame.repaint_requested = frame.repaint_requested || app_ctx.animations.run(&state);
+      if (app_ctx.animations.run(&state, app_ctx.widget_tree(), app_ctx.damage)) {
+        app_ctx.widget_tree().invalidate_layout();
+        repaint_pending = true;
+      }
       
-      if (frame.repaint_requested)
+      // Paint at most once per frame period
+      auto now = steady_clock::now();
+      if (repaint_pending && now - last_paint >= app_ctx.frame_period) {
         app_ctx.paint(); 
+        last_paint = now;
+        repaint_pending = false;
+      }
     }
   }
 };
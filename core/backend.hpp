@@ -10,6 +10,7 @@
 
 #include <iostream>
 #include <chrono>
+#include <vector>
 
 namespace weave {
 
@@ -34,13 +35,17 @@ class sdl_backend
   }
   
   template <class Ctx>
-  sdl_backend(Ctx* ctx)
+  sdl_backend(Ctx* ctx, bool headless = false)
   {
-    if (!SDL_Init(SDL_INIT_VIDEO))
+    // Note : a headless application only needs the event queue, eg. for user events
+    if (!SDL_Init(headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO))
     {
       fprintf(stderr, "failed to initialize SDL, aborting.");
       exit(1);
     }
+    
+    if (headless)
+      return;
   
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -53,7 +58,8 @@ class sdl_backend
   }
   
   void start_text_input(window& win) {
-    SDL_StartTextInput(win.get());
+    if (win.get())
+      SDL_StartTextInput(win.get());
   }
   
   void load_opengl()
@@ -65,13 +71,40 @@ class sdl_backend
 		}
   }
   
+  /// Wait at most timeout_ms for an event (indefinitely if timeout_ms is negative), 
+  /// then visit it and every other pending event.
+  /// Consecutive mouse motions and consecutive mouse scrolls are merged into one event.
   template <class Fn>
-  void visit_event(Fn vis) 
+  void visit_events(Fn vis, int timeout_ms) 
   {
     SDL_Event e;
-    if (not SDL_WaitEventTimeout(&e, 15))
+    if (not SDL_WaitEventTimeout(&e, timeout_ms))
       return;
     
+    batch.clear();
+    batch.push_back(e);
+    while (SDL_PollEvent(&e))
+      batch.push_back(e);
+    
+    for (unsigned k = 0; k < batch.size(); ++k) {
+      if (k + 1 < batch.size() && merge_into(batch[k], batch[k + 1]))
+        continue;
+      visit_event(batch[k], vis);
+    }
+  }
+  
+  /// Wake up a thread waiting in visit_events, can be called from any thread 
+  /// but the audio callback, since SDL_PushEvent locks the event queue and can allocate
+  static void wake_up() {
+    SDL_Event e;
+    SDL_zero(e);
+    e.type = SDL_EVENT_USER;
+    SDL_PushEvent(&e);
+  }
+  
+  template <class Fn>
+  void visit_event(const SDL_Event& e, Fn vis) 
+  {
     switch(e.type)
     {
       case SDL_EVENT_MOUSE_BUTTON_DOWN :
@@ -173,6 +206,25 @@ class sdl_backend
   
   private : 
   
+  std::vector<SDL_Event> batch;
+  
+  // Merge a into b if they are both mouse motions or mouse scrolls
+  static bool merge_into(const SDL_Event& a, SDL_Event& b) {
+    if (a.type != b.type)
+      return false;
+    if (a.type == SDL_EVENT_MOUSE_MOTION) {
+      b.motion.xrel += a.motion.xrel;
+      b.motion.yrel += a.motion.yrel;
+      return true;
+    }
+    if (a.type == SDL_EVENT_MOUSE_WHEEL) {
+      b.wheel.x += a.wheel.x;
+      b.wheel.y += a.wheel.y;
+      return true;
+    }
+    return false;
+  }
+  
   static vec2f pos(int x, int y){
 		return vec2f{ (float)x, (float)y };
 	}
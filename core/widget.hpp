@@ -20,6 +20,7 @@
 namespace weave {
 
 struct painter;
+struct render_layer;
 struct widget_tree;
 struct event_context;
 struct application_context;
@@ -41,6 +42,8 @@ struct widget_size_info {
   point max {infinity<float>(), infinity<float>()};
   point flex_factor{1, 1};
   optional<float> aspect_ratio = {}; // the ratio of width / height 
+  
+  bool operator==(const widget_size_info&) const = default;
 };
 
 struct widget_ref;
@@ -54,24 +57,26 @@ struct widget_id {
   
   friend struct widget_tree;
   
-  widget_id(const widget_id& o) : value{o.value} {}
+  widget_id(const widget_id& o) : value{o.value}, generation{o.generation} {}
   
   widget_id& operator=(widget_id o) {
     value = o.value;
+    generation = o.generation;
     return *this;
   }
   
   bool operator==(const widget_id& o) const {
-    return value == o.value;
+    return value == o.value && generation == o.generation;
   }
   
   unsigned raw() const { return value; }
   
   private : 
   
-  widget_id(unsigned x) : value{x} {}
+  widget_id(unsigned x, unsigned gen) : value{x}, generation{gen} {}
   
   unsigned value; 
+  unsigned generation;
 };
 
 } // weave
@@ -197,6 +202,7 @@ namespace impl
     ptr<void(widget_base*, destroy_context ctx)> destroy;
     ptr<void(widget_base*, widget_tree&, widget_id)> mount;
     ptr<void(widget_base*, widget_tree&)> unmount;
+    ptr<render_layer*(widget_base*)> offscreen_layer;
   };
   
   template <class T>
@@ -286,6 +292,11 @@ class widget_ref {
   
   bool is_child_event_listener() const { return vptr->on_child_event; }
   
+  /// The offscreen layer in which the widget and its children are painted, if any
+  render_layer* offscreen_layer() const {
+    return vptr->offscreen_layer ? vptr->offscreen_layer(data) : nullptr;
+  }
+  
   widget_size_info size_info() const { return vptr->size_info(data); }
   
   point size() const { return data->size(); }
@@ -368,23 +379,46 @@ struct widget_box : widget_ref {
   }
 };
 
+/// Maps widget ids to widgets and their parents.
+/// Nodes are stored in a dense vector indexed by the id, freed slots are reused
+/// with a new generation so that stale ids are never confused with new ones.
 struct widget_tree {
   
   widget_id new_id() {
-    while(tree.contains(widget_id{id_count}))
-      ++id_count;
-    return widget_id{id_count++};
+    while (free_slots.size()) {
+      auto idx = free_slots.back();
+      free_slots.pop_back();
+      auto& n = nodes[idx];
+      n.in_free_list = false;
+      // the slot was reoccupied by its previous owner since it was freed
+      if (n.ref.raw_pointer())
+        continue;
+      return widget_id{idx, ++n.generation};
+    }
+    nodes.emplace_back();
+    return widget_id{static_cast<unsigned>(nodes.size() - 1), 0};
   }
   
   optional<widget_ref> get(widget_id id) const {
-    auto it = tree.find(id);
-    if (it == tree.end())
+    if (!contains(id))
       return {};
-    return it->second.ref;
+    return nodes[id.value].ref;
+  }
+  
+  bool contains(widget_id id) const {
+    return id.value < nodes.size() 
+           && nodes[id.value].generation == id.generation 
+           && nodes[id.value].ref.raw_pointer();
   }
   
   void insert(widget_ref ref, widget_id parent) {
-    tree.insert_or_assign(ref.id(), node{parent, ref});
+    auto id = ref.id();
+    assert( id.value < nodes.size() && nodes[id.value].generation == id.generation 
+            && "inserting a widget with a stale id" );
+    auto& n = nodes[id.value];
+    n.ref = ref;
+    n.parent = parent.value;
+    ++epoch;
   }
   
   template <class W>
@@ -397,9 +431,14 @@ struct widget_tree {
   }
   
   void erase(widget_id id) {
-    auto it = tree.find(id);
-    assert( it != tree.end() && "widget already erased from tree" );
-    tree.erase(it);
+    assert( contains(id) && "widget already erased from tree" );
+    auto& n = nodes[id.value];
+    n.ref = {};
+    if (!n.in_free_list) {
+      n.in_free_list = true;
+      free_slots.push_back(id.value);
+    }
+    ++epoch;
   }
   
   void erase(const widget_base& w) {
@@ -426,9 +465,8 @@ struct widget_tree {
   }
   
   void relocate(widget_ref ref) {
-    auto it = tree.find(ref.id());
-    assert( it != tree.end() && "called relocate on an element not in the tree" );
-    it->second.ref = ref;
+    assert( contains(ref.id()) && "called relocate on an element not in the tree" );
+    nodes[ref.id().value].ref = ref;
   }
   
   template <class W>
@@ -436,6 +474,24 @@ struct widget_tree {
     relocate(widget_ref(&w));
   }
   
+  /// Must be called whenever widgets may have been moved, it invalidates the cached 
+  /// absolute offsets
+  void invalidate_layout() {
+    ++epoch;
+  }
+  
+  /// The number of parents between a widget and its root
+  unsigned depth(widget_id id) const {
+    assert( contains(id) && "widget not found in tree" );
+    return cached_node(id.value).depth;
+  }
+  
+  /// The sum of the positions of every parents of a widget
+  point absolute_offset(widget_id id) const {
+    assert( contains(id) && "widget not found in tree" );
+    return cached_node(id.value).offset;
+  }
+  
   struct parent_end_iterator {};
     
   struct parent_iterator {
@@ -503,9 +559,9 @@ struct widget_tree {
   }
   
   widget_id parent_of(widget_id id) const {
-    auto it = tree.find(id);
-    assert( it != tree.end() && "widget not found in tree" );
-    return it->second.parent;
+    assert( contains(id) && "widget not found in tree" );
+    auto p = nodes[id.value].parent;
+    return widget_id{p, nodes[p].generation};
   }
   
   widget_ref parent_ref(widget_id id) const {
@@ -515,12 +571,37 @@ struct widget_tree {
   private : 
   
   struct node {
-    widget_id parent;
     widget_ref ref;
+    unsigned parent = 0;
+    unsigned generation = 0;
+    bool in_free_list = false;
+    // cached values, valid while stamp == epoch
+    mutable unsigned stamp = 0;
+    mutable unsigned depth = 0;
+    mutable point offset {0, 0};
   };
   
-  std::unordered_map<widget_id, node> tree;
-  unsigned id_count = 0;
+  const node& cached_node(unsigned idx) const {
+    auto& n = nodes[idx];
+    if (n.stamp == epoch)
+      return n;
+    if (n.parent == idx) {
+      n.depth = 0;
+      n.offset = {0, 0};
+    }
+    else {
+      auto& p = cached_node(n.parent);
+      assert( p.ref.raw_pointer() && "parent not found in tree" );
+      n.depth = p.depth + 1;
+      n.offset = p.offset + p.ref.position();
+    }
+    n.stamp = epoch;
+    return n;
+  }
+  
+  std::vector<node> nodes;
+  std::vector<unsigned> free_slots;
+  unsigned epoch = 1;
 };
 
 void widget_base::destroy(this auto&& self, destroy_context ctx) {
@@ -532,10 +613,7 @@ void widget_base::destroy(this auto&& self, destroy_context ctx) {
 }
 
 point widget_base::absolute_position(const widget_tree& tree) const {
-  auto p = position();
-  for (auto parent : tree.parents_of(*this))
-    p += parent.position();
-  return p;
+  return position() + tree.absolute_offset(id());
 }
 
 void widget_base::mount(this auto& self, widget_tree& tree, widget_id parent) {
@@ -589,13 +667,33 @@ struct event_result {
 
 struct graphics_context;
 
+/// Identifies a running animation, to cancel it
+struct animation_handle {
+  unsigned index;
+  unsigned generation;
+};
+
 struct event_context {
 
-  /// Returns a thread safe callable that signal that a rebuild is needed
+  /// Returns a thread safe callable that signal that a rebuild is needed.
+  /// It wakes up the event loop with an SDL event, which locks and can allocate, 
+  /// so it must not be called from the audio callback : use lift_realtime_rebuild_request
   auto lift_rebuild_request();
   
+  /// Returns a wait free callable that signal that a rebuild is needed, eg. for the audio callback.
+  /// It only sets a flag, which the event loop polls every frame once such a callable was lifted.
+  auto lift_realtime_rebuild_request();
+  
   void request_rebuild() { frame_result.rebuild_requested = true; }
-  void request_repaint() { frame_result.repaint_requested = true; }
+  
+  /// Request a repaint of the whole window
+  void request_repaint();
+  
+  /// Request a repaint of the area of a widget only
+  void request_repaint(const widget_base& w);
+  
+  /// Request a repaint of a region of the window, in absolute coordinates
+  void request_repaint(rectangle r);
   
   widget_ref parent_of(widget_base& b) const;
   
@@ -607,7 +705,13 @@ struct event_context {
   
   /// Register an animation fn to be executed every period_in_ms
   template <class W, class Fn>
-  void animate(W& widget, Fn fn, int period_in_ms);
+  animation_handle animate(W& widget, Fn fn, int period_in_ms);
+  
+  /// Register an animation fn to be executed once per frame
+  template <class W, class Fn>
+  animation_handle animate_frames(W& widget, Fn fn);
+  
+  void cancel_animation(animation_handle h);
   
   /// Remove all animations for a widget
   void deanimate(widget_ref w);
@@ -656,6 +760,16 @@ namespace impl {
       return nullptr;
   }
   
+  template <class W>
+  consteval auto offscreen_layer_fn_ptr() {
+    if constexpr ( requires (W& obj) { obj.offscreen_layer(); } )
+      return + [] (widget_base* self) -> render_layer* {
+        return &static_cast<W*>(self)->offscreen_layer();
+      };
+    else
+      return nullptr;
+  }
+  
   template <class W>
   struct widget_vtable_impl 
   {
@@ -707,7 +821,8 @@ namespace impl {
       },
       +[] (widget_base* self, widget_tree& tree) {
         static_cast<W*>(self)->unmount(tree);
-      }
+      },
+      offscreen_layer_fn_ptr<W>()
     };
   };
 }
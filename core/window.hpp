@@ -9,17 +9,23 @@ namespace weave {
 struct window_properties {
   std::string name;
   vec2f size {600, 400};
+  // No window is created, and painting is done in memory, see software_renderer
+  bool headless = false;
 };
 
 struct window {
   
   window(window_properties prop) {
-    init(prop.name.data(), prop.size.x, prop.size.y);
+    if (prop.headless)
+      headless_size = prop.size;
+    else
+      init(prop.name.data(), prop.size.x, prop.size.y);
   }
   
   window(window&& w) noexcept {
     win    = std::exchange(w.win,  nullptr);
     gl_ctx = std::exchange(gl_ctx, nullptr);
+    headless_size = w.headless_size;
   }
   
   ~window(){
@@ -42,6 +48,8 @@ struct window {
   bool is_active() const { return win; }
 
   vec2f size() const {
+    if (!win)
+      return headless_size;
     vec2i res;
     SDL_GetWindowSize(win, &res.x, &res.y);
     return {(float)res.x, (float)res.y};
@@ -59,7 +67,16 @@ struct window {
   }
   
   void swap_buffer() {
-    SDL_GL_SwapWindow(win);
+    if (win)
+      SDL_GL_SwapWindow(win);
+  }
+  
+  /// The refresh rate of the display of the window, 0 if unknown
+  float refresh_rate() const {
+    if (!win)
+      return 0;
+    auto mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(win));
+    return mode ? mode->refresh_rate : 0.f;
   }
   
   private :
@@ -69,8 +86,9 @@ struct window {
     gl_ctx = SDL_GL_CreateContext(win);
   }
   
-  SDL_Window* win;
-  SDL_GLContext gl_ctx;
+  SDL_Window* win = nullptr;
+  SDL_GLContext gl_ctx = nullptr;
+  vec2f headless_size {0, 0};
 };
 
 } // weave
\ No newline at end of file
@@ -18,22 +18,16 @@ using namespace weave;
 struct TrackPlayer : weave::audio_renderer<TrackPlayer>
 {
   void render_audio(weave::audio_output_stream& os) {
-    if (head == -1)
+    if (!reader.is_open())
       return;
-    auto src_begin = buffer.begin() + head;
-    auto src_end = buffer.begin() + head + os.num_samples();
-    if (src_end > buffer.end()) {
-      src_end = buffer.end();
-      head = -1; 
+    auto frames = reader.read({os.begin(), os.end()});
+    std::fill(os.begin() + frames * reader.num_channels(), os.end(), 0.f);
+    if (reader.at_end())
       done_reading = true;
-    }
-    std::copy(src_begin, src_end, os.begin());
-    head += os.num_samples();
   }
   
   std::atomic<float> volume = 1.f;
-  weave::audio_buffer buffer;
-  std::atomic<int> head = -1;
+  weave::audio_file_reader reader;
   std::atomic<bool> done_reading = false;
 };
 
@@ -337,11 +331,12 @@ struct State : weave::app_state {
   }
   
   float current_track_position() const {
-    return (float)player.head / player.buffer.size();
+    auto total = player.reader.total_frames();
+    return total ? (float)player.reader.position() / total : 0.f;
   }
   
   void set_track_position(float ratio) {
-    player.head = ratio * player.buffer.size();
+    player.reader.seek(ratio * player.reader.total_frames());
   }
   
   bool set_play(bool Play) {
@@ -364,11 +359,11 @@ struct State : weave::app_state {
     {
       auto id = *current_track_id;
       auto& path = database.track(id).file_path;
-      auto buf = read_audio_file(path);
-      if (!buf)
+      // Open the device first to decode the file at its sample rate
+      if (!player.is_initialized())
+        player.init_audio_render();
+      if (!player.reader.open(path, player.samplerate()))
         return;
-      player.buffer = *buf;
-      player.head = 0;
       buffer_track_id = *current_track_id;
       auto cover = read_file_cover(path);
       if (cover) {
@@ -377,7 +372,7 @@ struct State : weave::app_state {
       player.done_reading = false;
     }
     
-    player.start_audio_render();
+    player.resume_audio_render();
     is_playing_v = true;
   }
   
@@ -426,7 +421,9 @@ struct State : weave::app_state {
   
   // in seconds
   int current_track_length() const {
-    return player.buffer.size() / (player.buffer.num_channels * player.samplerate());
+    if (!player.reader.is_open())
+      return 0;
+    return player.reader.total_frames() / player.reader.sample_rate();
   }
   
   void check_done_reading() {
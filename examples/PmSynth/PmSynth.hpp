@@ -38,7 +38,7 @@ struct PmSynth : audio_renderer<PmSynth>, app_state
   void render_audio(audio_output_stream os)
   {
     auto _ = std::shared_lock{mut};
-    float dt = 1.f / 44100.f;
+    float dt = 1.f / samplerate();
     for (auto s : os) 
     {
       for (auto& r : mod_matrix)
@@ -87,14 +87,14 @@ struct SpringSim : app_state, audio_renderer<SpringSim> {
   
   void trigger_particle(int index) {
     auto _ = write_scope();
-    get_particle(index).force = 44100 * 400;
+    get_particle(index).force = samplerate() * 400;
   }
   
   void render_audio(audio_output_stream os)
   {
     auto _ = read_scope();
     
-    float timestep = 1.f / 44100.f;
+    float timestep = 1.f / samplerate();
     
     float phase = 0;
     
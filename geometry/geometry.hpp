@@ -10,6 +10,7 @@ using point = vec2<float>;
 using rectangle = geo::rectangle<float>;
 using triangle = geo::triangle<float>;
 using circle = geo::circle<float>;
+using segment = geo::segment<float>;
 
 template <class T>
 auto& operator<<(std::ostream& os, const vec<T, 2>& v) {
@@ -25,6 +25,37 @@ struct rectangle {
     return Res;
   }
   
+  constexpr vec2<T> end() const {
+    return origin + size;
+  }
+  
+  constexpr T area() const {
+    return size.x * size.y;
+  }
+  
+  constexpr bool empty() const {
+    return size.x <= 0 || size.y <= 0;
+  }
+  
+  constexpr bool intersects(const rectangle& o) const {
+    return origin.x < o.origin.x + o.size.x && o.origin.x < origin.x + size.x
+           && origin.y < o.origin.y + o.size.y && o.origin.y < origin.y + size.y;
+  }
+  
+  /// The intersection of both rectangles, with an empty size if they don't intersect.
+  constexpr rectangle intersection(const rectangle& o) const {
+    auto a = max(origin, o.origin);
+    auto b = min(end(), o.end());
+    return {a, max(b - a, vec2<T>{0, 0})};
+  }
+  
+  /// The smallest rectangle containing both rectangles.
+  constexpr rectangle bounding_union(const rectangle& o) const {
+    auto a = min(origin, o.origin);
+    auto b = max(end(), o.end());
+    return {a, b - a};
+  }
+  
   vec2<T> origin, size;
 };
 
@@ -126,4 +157,14 @@ struct triangle {
   vec2<T> a, b, c;
 };
 
+template <class T>
+struct segment {
+  
+  constexpr auto translated(const vec2<T>& p) const {
+    return segment{a + p, b + p};
+  }
+  
+  vec2<T> a, b;
+};
+
 } // weave::geo
\ No newline at end of file
@@ -4,6 +4,7 @@
 #define NANOVG_GL3_IMPLEMENTATION
 
 #include "nanovg_gl.h"
+#include "nanovg_gl_utils.h"
 #include <SDL3/SDL.h>
 
 #include "misc/default_font_embed"
@@ -14,8 +15,15 @@
 
 namespace weave {
 
-graphics_context::graphics_context()
+graphics_context::graphics_context(render_backend backend, vec2i size)
 {
+  if (backend == render_backend::software) {
+    software = std::make_unique<software_renderer>(size);
+    ctx = software->create_context();
+    create_font_from_memory("default", default_font_data);
+    return;
+  }
+  
   if (!gladLoadGLLoader((GLADloadproc) SDL_GL_GetProcAddress))
   {
     fprintf(stderr, "failed to initialize the OpenGL context.");
@@ -30,6 +38,117 @@ graphics_context::graphics_context()
   glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
 }
 
+bool graphics_context::bind_retained_frame(vec2i size)
+{
+  // the surface of the software backend is kept between frames
+  if (software) {
+    if (software->size() == size)
+      return true;
+    software->resize(size);
+    return false;
+  }
+  if (retained_frame && size == retained_frame_size) {
+    nvgluBindFramebuffer(retained_frame);
+    return true;
+  }
+  if (retained_frame)
+    nvgluDeleteFramebuffer(retained_frame);
+  retained_frame = nvgluCreateFramebuffer(ctx, size.x, size.y, 0);
+  retained_frame_size = size;
+  nvgluBindFramebuffer(retained_frame);
+  return false;
+}
+
+void graphics_context::present_retained_frame()
+{
+  if (software)
+    return;
+  assert( retained_frame && "no retained frame to present" );
+  auto [w, h] = retained_frame_size;
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, retained_frame->fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  nvgluBindFramebuffer(nullptr);
+}
+
+void graphics_context::begin_layer(render_layer& l, vec2i size)
+{
+  if (software) {
+    if (!l.image || l.size != size) {
+      delete_layer(l);
+      l.image = software->create_render_target(size);
+      l.size = size;
+    }
+    software->bind_render_target(l.image);
+    software->clear(rgba_f{colors::black}.with_alpha(0));
+    nvgBeginFrame(ctx, size.x, size.y, 1);
+    return;
+  }
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &layer_saved_fbo);
+  glGetIntegerv(GL_VIEWPORT, layer_saved_viewport);
+  if (!l.frame || l.size != size) {
+    delete_layer(l);
+    // nanovg paints premultiplied colors, and GL textures are upside down
+    l.frame = nvgluCreateFramebuffer(ctx, size.x, size.y, NVG_IMAGE_PREMULTIPLIED | NVG_IMAGE_FLIPY);
+    l.image = l.frame->image;
+    l.size = size;
+  }
+  nvgluBindFramebuffer(l.frame);
+  glViewport(0, 0, size.x, size.y);
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
+  glEnable(GL_STENCIL_TEST);
+  nvgBeginFrame(ctx, size.x, size.y, 1);
+}
+
+void graphics_context::end_layer(render_layer& l)
+{
+  nvgEndFrame(ctx);
+  if (software) {
+    software->bind_render_target(0);
+    l.dirty = false;
+    return;
+  }
+  glDisable(GL_STENCIL_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, layer_saved_fbo);
+  auto* v = layer_saved_viewport;
+  glViewport(v[0], v[1], v[2], v[3]);
+  l.dirty = false;
+}
+
+void graphics_context::paint_rasterized_caches()
+{
+  for (auto& weak : pending_rasters) {
+    auto r = weak.lock();
+    // the widget of the cache was destroyed since its paint
+    if (!r)
+      continue;
+    r->pending = false;
+    if (r->size.x <= 0 || r->size.y <= 0)
+      continue;
+    begin_layer(r->layer, r->size);
+    {
+      auto p = painter();
+      nvgFontFaceId(ctx, r->font);
+      p.current_font = r->font;
+      p.replay(r->list);
+    }
+    end_layer(r->layer);
+  }
+  pending_rasters.clear();
+}
+
+void graphics_context::delete_layer(render_layer& l)
+{
+  if (l.frame)
+    nvgluDeleteFramebuffer(l.frame);
+  else if (l.image)
+    nvgDeleteImage(ctx, l.image);
+  l.frame = nullptr;
+  l.image = 0;
+  l.dirty = true;
+}
+
 std::optional<image<rgba<unsigned char>>> decode_image(std::span<const unsigned char> data) {
   int w, h, n;
   auto img_data = stbi_load_from_memory(data.data(), data.size(), &w, &h, &n, 4);
@@ -2,6 +2,8 @@
 
 #include "color.hpp"
 #include "image.hpp"
+#include "software_renderer.hpp"
+#include "text_cache.hpp"
 #include "../geometry/geometry.hpp"
 
 #include "util/iota.hpp"
@@ -11,10 +13,17 @@
 #include "nanovg.h"
 
 #include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
 #include <optional>
 #include <vector>
+#include <span>
 #include <string>
 #include <string_view>
+#include <utility>
+
+struct NVGLUframebuffer;
 
 namespace weave {
 
@@ -73,6 +82,120 @@ struct rounded_rectangle : rectangle {
   std::array<float, 4> rounding;
 };
 
+/// An offscreen frame buffer in which a subtree of widgets is painted once, 
+/// then drawn as a texture until it's invalidated.
+struct render_layer {
+  
+  /// Must be called whenever the content of the layer changes
+  void invalidate() { dirty = true; }
+  
+  bool is_ready(point sz) const {
+    return image && !dirty && size == vec2i{(int)sz.x, (int)sz.y};
+  }
+  
+  // null with the software backend, which paints directly into the image
+  NVGLUframebuffer* frame = nullptr;
+  int image = 0;
+  vec2i size {0, 0};
+  bool dirty = true;
+};
+
+/// A recording of the drawing commands issued through a painter, which can be replayed 
+/// without running again the code which issued them. 
+/// Commands are stored as a compact stream of opcodes, with their arguments in separate arrays.
+struct display_list {
+  
+  enum class op : std::uint8_t {
+    begin_path, close_path, move_to, line_to, rect, rounded_rect, circle, rects, segments,
+    fill, stroke, stroke_color, fill_color, fill_texture,
+    text, font_size, font_face, text_align,
+    scissor, intersect_scissor, reset_scissor, translate, save, restore
+  };
+  
+  void clear() {
+    ops.clear();
+    floats.clear();
+    ints.clear();
+    strings.clear();
+  }
+  
+  bool empty() const { return ops.empty(); }
+  
+  /// The number of commands
+  std::size_t size() const { return ops.size(); }
+  
+  /// Append the commands of another list
+  void append(const display_list& o) {
+    ops.insert(ops.end(), o.ops.begin(), o.ops.end());
+    floats.insert(floats.end(), o.floats.begin(), o.floats.end());
+    ints.insert(ints.end(), o.ints.begin(), o.ints.end());
+    strings.append(o.strings);
+  }
+  
+  private :
+  
+  friend painter;
+  
+  void push(op o, std::initializer_list<float> args = {}) {
+    ops.push_back(o);
+    floats.insert(floats.end(), args);
+  }
+  
+  // Note : strings are read back in order, so only their length is stored and appending
+  // a list needs no fixup. They are null terminated for nanovg.
+  void push_string(std::string_view s) {
+    ints.push_back((int)s.size());
+    strings.append(s);
+    strings.push_back('\0');
+  }
+  
+  std::vector<op> ops;
+  std::vector<float> floats;
+  std::vector<int> ints;
+  std::string strings;
+};
+
+struct graphics_context;
+
+namespace impl {
+  
+  // The offscreen layer of a rasterized paint_cache, shared with the graphics_context
+  // which paints the list in it before the next frame
+  struct cache_raster {
+    
+    cache_raster() = default;
+    cache_raster(const cache_raster&) = delete;
+    ~cache_raster();
+    
+    display_list list;
+    render_layer layer;
+    vec2i size {0, 0};
+    int font = 0;
+    graphics_context* graphics = nullptr;
+    bool pending = false;
+  };
+}
+
+/// The display list of the last paint of a widget, replayed as long as the widget 
+/// is unchanged and keeps the same size.
+struct paint_cache {
+  
+  /// A rasterized cache is painted once in an offscreen layer, which is then drawn as a 
+  /// texture instead of replaying the list : replaying a text still shapes and tessellates 
+  /// its glyphs, so this is for the paints which are mostly text.
+  /// Its paint must be within (0, 0) and the size of the cache, and set the styles it uses.
+  explicit paint_cache(bool rasterized = false) : rasterized{rasterized} {}
+  
+  /// Must be called whenever what the widget paints changes
+  void invalidate() { valid = false; }
+  
+  display_list list;
+  point size {0, 0};
+  bool valid = false;
+  bool rasterized = false;
+  std::shared_ptr<impl::cache_raster> raster;
+};
+
 struct painter
 {
   using color = rgba_f;
@@ -81,17 +204,56 @@ struct painter
   float text_vert_offset = 0;
   int current_alignment = 0;
   float current_font_size = 11;
+  // every command issued is also appended to this list, when set
+  display_list* recording = nullptr;
+  // set when painting with the software backend instead of OpenGL
+  software_renderer* software = nullptr;
+  // the measures of strings, shared with the graphics_context
+  text_cache* texts = nullptr;
+  int current_font = 0;
+  // the rasterized caches to paint before the next frame, and their graphics_context
+  std::vector<std::weak_ptr<impl::cache_raster>>* pending_rasters = nullptr;
+  graphics_context* graphics = nullptr;
   
   void begin_frame(vec2f size, int ratio){
+    if (software) {
+      if (software->size() != vec2i{(int)size.x, (int)size.y})
+        software->resize(vec2i{(int)size.x, (int)size.y});
+      software->clear(rgba_f{colors::black});
+      nvgBeginFrame(ctx, size.x, size.y, ratio);
+      return;
+    }
     glClearColor(0, 0, 0, 1);
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
     glEnable(GL_STENCIL_TEST);
     nvgBeginFrame(ctx, size.x, size.y, ratio);
   }
   
+  /// Begin a frame which only clears the damaged regions of the frame buffer,
+  /// the rest of its content is left as is.
+  void begin_partial_frame(vec2f size, int ratio, std::span<const rectangle> damaged) {
+    if (software) {
+      for (auto& r : damaged)
+        software->clear(rgba_f{colors::black}, r);
+      nvgBeginFrame(ctx, size.x, size.y, ratio);
+      return;
+    }
+    glClearColor(0, 0, 0, 1);
+    glEnable(GL_SCISSOR_TEST);
+    for (auto& r : damaged) {
+      // GL has its origin at the bottom left
+      glScissor(r.origin.x, size.y - r.origin.y - r.size.y, r.size.x, r.size.y);
+      glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
+    }
+    glDisable(GL_SCISSOR_TEST);
+    glEnable(GL_STENCIL_TEST);
+    nvgBeginFrame(ctx, size.x, size.y, ratio);
+  }
+  
   void end_frame(){
     nvgEndFrame(ctx);
-    glDisable(GL_STENCIL_TEST);
+    if (!software)
+      glDisable(GL_STENCIL_TEST);
   }
   
   struct scissor_raii {
@@ -102,28 +264,33 @@ struct painter
   };
   
   [[nodiscard]] scissor_raii scissor(point pos, point size){
-    nvgScissor(ctx, pos.x, pos.y, size.x, size.y);
+    set_scissor(pos, size);
     return {*this};
   }
   
   void intersect_scissor(point pos, point size) {
+    if (recording)
+      recording->push(display_list::op::intersect_scissor, {pos.x, pos.y, size.x, size.y});
     nvgIntersectScissor(ctx, pos.x, pos.y, size.x, size.y);
   }
 
   void reset_scissor() {
+    if (recording)
+      recording->push(display_list::op::reset_scissor);
     nvgResetScissor(ctx);
   }
   
   void text_align(text_align::x alignx, text_align::y aligny = text_align::y::center)
   {
-    current_alignment = (int)(alignx) | (int)(aligny);
-    nvgTextAlign(ctx, current_alignment);
+    set_text_align((int)(alignx) | (int)(aligny));
   }
 
   // return the text bounding box if it were drawn at the given position
   // using the current alignment
   vec2f text_bounds(std::string_view str) const
   {
+    if (texts)
+      return texts->get(ctx, current_font, current_font_size, str).bounds;
     float bounds[4];
     nvgTextBounds(ctx, 0, 0, str.data(), str.end(), bounds);
     return vec2f{ bounds[2] - bounds[0], bounds[3] - bounds[1] };
@@ -135,27 +302,40 @@ struct painter
 
   // Set the current font size
   void font_size(float size){
+    if (recording)
+      recording->push(display_list::op::font_size, {size});
     current_font_size = size;
     nvgFontSize(ctx, size);
     update_font_offset();
   }
 
   void set_font(const char* ident){
+    if (recording) {
+      recording->push(display_list::op::font_face);
+      recording->push_string(ident);
+    }
     nvgFontFace(ctx, ident);
+    current_font = nvgFindFont(ctx, ident);
     update_font_offset();
   }
   
   auto& begin_path() {
+    if (recording)
+      recording->push(display_list::op::begin_path);
     nvgBeginPath(ctx);
     return *this;
   }
   
   auto& close_path() {
+    if (recording)
+      recording->push(display_list::op::close_path);
     nvgClosePath(ctx);
     return *this;
   }
   
   auto& path(circle c) {
+    if (recording)
+      recording->push(display_list::op::circle, {c.center.x, c.center.y, c.radius});
     nvgCircle(ctx, c.center.x, c.center.y, c.radius);
     return *this;
   }
@@ -166,31 +346,72 @@ struct painter
   }
   
   auto& path(const rectangle& r) {
+    if (recording)
+      recording->push(display_list::op::rect, {r.origin.x, r.origin.y, r.size.x, r.size.y});
     nvgRect(ctx, r.origin.x, r.origin.y, r.size.x, r.size.y);
     return *this;
   }
   
+  /// Add many rectangles to the current path
+  auto& path(std::span<const rectangle> rects) {
+    if (recording) {
+      recording->push(display_list::op::rects);
+      recording->ints.push_back((int)rects.size());
+      for (auto& r : rects)
+        recording->floats.insert(recording->floats.end(), {r.origin.x, r.origin.y, r.size.x, r.size.y});
+    }
+    for (auto& r : rects)
+      nvgRect(ctx, r.origin.x, r.origin.y, r.size.x, r.size.y);
+    return *this;
+  }
+  
+  /// Add many disjoint segments to the current path
+  auto& path(std::span<const segment> segments) {
+    if (recording) {
+      recording->push(display_list::op::segments);
+      recording->ints.push_back((int)segments.size());
+      for (auto& s : segments)
+        recording->floats.insert(recording->floats.end(), {s.a.x, s.a.y, s.b.x, s.b.y});
+    }
+    for (auto& s : segments) {
+      nvgMoveTo(ctx, s.a.x, s.a.y);
+      nvgLineTo(ctx, s.b.x, s.b.y);
+    }
+    return *this;
+  }
+  
   auto& path(const rounded_rectangle& r) {
+    if (recording)
+      recording->push(display_list::op::rounded_rect, {r.origin.x, r.origin.y, r.size.x, r.size.y, 
+                      r.rounding[0], r.rounding[1], r.rounding[2], r.rounding[3]});
     nvgRoundedRectVarying(ctx, r.origin.x, r.origin.y, r.size.x, r.size.y, 
                           r.rounding[0], r.rounding[1], r.rounding[2], r.rounding[3]);
     return *this;
   }
   
   painter& move_to(point p) {
+    if (recording)
+      recording->push(display_list::op::move_to, {p.x, p.y});
     nvgMoveTo(ctx, p.x, p.y);
     return *this;
   }
 
   painter& line_to(point p) {
+    if (recording)
+      recording->push(display_list::op::line_to, {p.x, p.y});
     nvgLineTo(ctx, p.x, p.y);
     return *this;
   }
   
   void fill_path() {
+    if (recording)
+      recording->push(display_list::op::fill);
     nvgFill(ctx);
   }
   
   void stroke_path(float thickness) {
+    if (recording)
+      recording->push(display_list::op::stroke, {thickness});
     nvgStrokeWidth(ctx, thickness);
     nvgStroke(ctx);
   }
@@ -211,67 +432,117 @@ struct painter
     line_to(b);
     stroke_path(thick);
   }
+  
+  // Note : nanovg has no batched draw, a fill or a stroke is still one draw call per subpath.
+  // A fill of several subpaths isn't convex, and goes through the stencil, so each rectangle
+  // is filled as its own convex path.
+  
+  /// Fill many rectangles with the current fill style
+  void fill_rects(std::span<const rectangle> rects) {
+    for (auto& r : rects)
+      fill(r);
+  }
+  
+  /// Fill many rectangles, each with its color. The fill style is only set when the color
+  /// changes, so sort them by color.
+  void fill_rects(std::span<const rectangle> rects, std::span<const color> colors) {
+    assert( rects.size() == colors.size() && "one color per rectangle" );
+    for (std::size_t k = 0, n; k < rects.size(); k += n) {
+      n = 1;
+      while (k + n < rects.size() && colors[k + n] == colors[k])
+        ++n;
+      fill_style(colors[k]);
+      fill_rects(rects.subspan(k, n));
+    }
+  }
+  
+  /// Stroke many segments with the current stroke style, as a single path,
+  /// so that the stroke is set up once for all of them
+  void lines(std::span<const segment> segments, float thickness = 1) {
+    if (segments.empty())
+      return;
+    begin_path().path(segments).stroke_path(thickness);
+  }
 
   void stroke_style(const color& c) {
-    nvgStrokeColor(ctx, impl::to_nvg_col(c));
+    set_stroke_color(impl::to_nvg_col(c));
   }
 
   void fill_style(const color& c) {
-    nvgFillColor(ctx, impl::to_nvg_col(c));
+    set_fill_color(impl::to_nvg_col(c));
   }
   
   void fill_style(texture_handle t, point top_left, point size) {
+    if (recording) {
+      recording->push(display_list::op::fill_texture, {top_left.x, top_left.y, size.x, size.y});
+      recording->ints.push_back(t.id);
+    }
     auto p = nvgImagePattern(ctx, top_left.x, top_left.y, size.x, size.y, 0, t.id, 1.f);
     nvgFillPaint(ctx, p);
   }
   
+  /// Draw the content of a layer at the origin
+  void draw_layer(const render_layer& l, point size) {
+    fill_style(texture_handle{l.image}, {0, 0}, size);
+    fill(rectangle(size));
+  }
+  
   void text(point pos, std::string_view v) {
+    if (recording) {
+      recording->push(display_list::op::text, {pos.x, pos.y});
+      recording->push_string(v);
+    }
     nvgText(ctx, pos.x, pos.y - this->text_vert_offset, v.data(), v.end());
   }
   
+  /// Draw a text, truncated with an ellipsis if it's wider than width. 
+  /// The layout of the text and its truncation are cached.
   void text_bounded(point pos, float width, std::string_view str) {
     if (str == "")
       return;
-    float bounds[4];
-    std::vector<NVGglyphPosition> positions;
-    positions.resize(str.size());
-    nvgTextGlyphPositions( ctx, pos.x, pos.y, str.begin(), str.end(), positions.data(), (int)(positions.size()) );
+    assert( texts && "text_bounded needs the text cache of a graphics_context" );
+    auto& layout = texts->get(ctx, current_font, current_font_size, str, true);
+    auto& positions = layout.positions;
+    if (positions.empty())
+      return;
     
     if (positions.back().maxx - positions.front().minx > width) {
-      // Look at the space needed to display ... 
-      /* 
-      NVGglyphPosition ellipsisPos[3];
-      nvgTextGlyphPositions(ctx, 0, 0, "...", nullptr, ellipsisPos, 3);
-      auto ellipsis_width = ellipsisPos[2].maxx; */ 
-      
-      nvgSave(ctx);
+      save();
       
       // apply the scissor horizontally
       intersect_scissor({pos.x, pos.y - (float)1e6}, {width, 2 * 1e6});
       
       auto ellipsis_width = font_size();
       
-      auto it = std::find_if( positions.rbegin(), positions.rend(), 
-        [&] (auto& e) { return e.maxx + ellipsis_width < positions.front().minx + width; } );
+      if (layout.truncated_width != width) {
+        auto it = std::find_if( positions.rbegin(), positions.rend(), 
+          [&] (auto& e) { return e.maxx + ellipsis_width < positions.front().minx + width; } );
+        // the glyphs before the ellipsis, as a number of bytes
+        std::size_t num_glyphs = positions.rend() - it;
+        layout.truncated_width = width;
+        layout.truncated_index = num_glyphs < positions.size() 
+          ? positions[num_glyphs].str - layout.str.data() : str.size();
+      }
       
-      int index = it == positions.rend() ? 0 : (int) str.size() - (it - positions.rbegin());
+      text( pos, str.substr(0, layout.truncated_index) );
       
-      text( pos, std::string_view{str.begin(), str.begin() + index} );
+      // the positions are those of the text left aligned at the origin
+      auto align_offset = (current_alignment & NVG_ALIGN_RIGHT) ? -layout.advance
+                        : (current_alignment & NVG_ALIGN_CENTER) ? -layout.advance / 2 : 0.f;
       
       // FIXME : Take into account top alignment
       auto ellipsis_y = (current_alignment | (int) text_align::y::center) 
         ? (pos.y + font_size() / 2 - ellipsis_width / 10)
         : pos.y; 
         
-      auto c = circle(vec2f{positions[0].minx + width, ellipsis_y}, ellipsis_width / 10);
+      auto c = circle(vec2f{pos.x + align_offset + positions[0].minx + width, ellipsis_y}, ellipsis_width / 10);
       c = c.translated({-c.radius * 2 - 3, 0});
       
       fill( c );
       fill( c.translated({-ellipsis_width / 3, 0}) );
       fill( c.translated({-2 * ellipsis_width / 3, 0}) );
       
-      nvgRestore(ctx);
-      // text( vec2f{positions[index].minx, pos.y}, "..." );
+      restore();
       
       return;
     }
@@ -283,17 +554,201 @@ struct painter
     painter& self;
     vec2f delta;
     ~translation_raii() {
-      nvgTranslate(self.ctx, -delta.x, -delta.y);
+      self.translate_by(-delta);
     }
   };
   
   [[nodiscard]] translation_raii translate(point delta) {
-    nvgTranslate(ctx, delta.x, delta.y);
+    translate_by(delta);
     return translation_raii{*this, delta}; 
   }
   
+  /// Paint with fn, recording what it paints in the cache, or replay the cache instead
+  /// if it's still valid for this size.
+  void cached(paint_cache& cache, point size, auto&& fn) {
+    if (cache.valid && cache.size == size) {
+      // Note : a recording in progress needs the commands, not the texture of the layer
+      if (cache.raster && !recording && cache.raster->layer.is_ready(size)) {
+        save();
+        draw_layer(cache.raster->layer, size);
+        restore();
+        return;
+      }
+      // Rasterized once the cache was replayed at the same size, so not while resizing
+      if (cache.rasterized && !recording && pending_rasters)
+        rasterize(cache, size);
+      replay(cache.list);
+      return;
+    }
+    if (cache.raster)
+      cache.raster->layer.invalidate();
+    auto* parent = recording;
+    cache.list.clear();
+    recording = &cache.list;
+    // the layer is painted from a clean state, so the replay of the list must not leak its styles
+    if (cache.rasterized)
+      save();
+    fn();
+    if (cache.rasterized)
+      restore();
+    recording = parent;
+    if (parent)
+      parent->append(cache.list);
+    cache.size = size;
+    cache.valid = true;
+  }
+  
+  /// Issue again every command of a display list
+  void replay(const display_list& list) {
+    using op = display_list::op;
+    // a recording in progress gets the list as is, rather than the commands replayed one by one
+    auto* parent = std::exchange(recording, nullptr);
+    const float* f = list.floats.data();
+    const int* i = list.ints.data();
+    const char* s = list.strings.data();
+    auto pt = [&f] { f += 2; return point{f[-2], f[-1]}; };
+    auto col = [&f] { f += 4; return nvgRGBAf(f[-4], f[-3], f[-2], f[-1]); };
+    auto str = [&i, &s] { 
+      auto res = std::string_view{s, (std::size_t)*i++}; 
+      s += res.size() + 1; 
+      return res; 
+    };
+    
+    for (auto o : list.ops) {
+      switch (o) {
+        case op::begin_path : begin_path(); break;
+        case op::close_path : close_path(); break;
+        case op::move_to : move_to(pt()); break;
+        case op::line_to : line_to(pt()); break;
+        case op::rect : {
+          auto origin = pt();
+          path(rectangle{origin, pt()});
+          break;
+        }
+        case op::rounded_rect : {
+          auto origin = pt();
+          auto sz = pt();
+          f += 4;
+          path(rounded_rectangle{rectangle{origin, sz}, {f[-4], f[-3], f[-2], f[-1]}});
+          break;
+        }
+        case op::circle : {
+          auto center = pt();
+          path(circle{center, *f++});
+          break;
+        }
+        case op::rects : {
+          for (int n = *i++; n > 0; --n, f += 4)
+            nvgRect(ctx, f[0], f[1], f[2], f[3]);
+          break;
+        }
+        case op::segments : {
+          for (int n = *i++; n > 0; --n, f += 4) {
+            nvgMoveTo(ctx, f[0], f[1]);
+            nvgLineTo(ctx, f[2], f[3]);
+          }
+          break;
+        }
+        case op::fill : fill_path(); break;
+        case op::stroke : stroke_path(*f++); break;
+        case op::stroke_color : set_stroke_color(col()); break;
+        case op::fill_color : set_fill_color(col()); break;
+        case op::fill_texture : {
+          auto top_left = pt();
+          fill_style(texture_handle{*i++}, top_left, pt());
+          break;
+        }
+        case op::text : {
+          auto pos = pt();
+          text(pos, str());
+          break;
+        }
+        case op::font_size : font_size(*f++); break;
+        case op::font_face : set_font(str().data()); break;
+        case op::text_align : set_text_align(*i++); break;
+        case op::scissor : {
+          auto pos = pt();
+          set_scissor(pos, pt());
+          break;
+        }
+        case op::intersect_scissor : {
+          auto pos = pt();
+          intersect_scissor(pos, pt());
+          break;
+        }
+        case op::reset_scissor : reset_scissor(); break;
+        case op::translate : translate_by(pt()); break;
+        case op::save : save(); break;
+        case op::restore : restore(); break;
+      }
+    }
+    
+    recording = parent;
+    if (parent)
+      parent->append(list);
+  }
+  
   private : 
   
+  void rasterize(paint_cache& cache, point size) {
+    if (!cache.raster)
+      cache.raster = std::make_shared<impl::cache_raster>();
+    auto& r = *cache.raster;
+    if (r.pending)
+      return;
+    r.list = cache.list;
+    r.size = vec2i{(int)size.x, (int)size.y};
+    r.font = current_font;
+    r.graphics = graphics;
+    r.pending = true;
+    pending_rasters->push_back(cache.raster);
+  }
+  
+  void translate_by(point delta) {
+    if (recording)
+      recording->push(display_list::op::translate, {delta.x, delta.y});
+    nvgTranslate(ctx, delta.x, delta.y);
+  }
+  
+  void set_scissor(point pos, point size) {
+    if (recording)
+      recording->push(display_list::op::scissor, {pos.x, pos.y, size.x, size.y});
+    nvgScissor(ctx, pos.x, pos.y, size.x, size.y);
+  }
+  
+  void set_text_align(int alignment) {
+    if (recording) {
+      recording->push(display_list::op::text_align);
+      recording->ints.push_back(alignment);
+    }
+    current_alignment = alignment;
+    nvgTextAlign(ctx, alignment);
+  }
+  
+  void set_stroke_color(NVGcolor c) {
+    if (recording)
+      recording->push(display_list::op::stroke_color, {c.r, c.g, c.b, c.a});
+    nvgStrokeColor(ctx, c);
+  }
+  
+  void set_fill_color(NVGcolor c) {
+    if (recording)
+      recording->push(display_list::op::fill_color, {c.r, c.g, c.b, c.a});
+    nvgFillColor(ctx, c);
+  }
+  
+  void save() {
+    if (recording)
+      recording->push(display_list::op::save);
+    nvgSave(ctx);
+  }
+  
+  void restore() {
+    if (recording)
+      recording->push(display_list::op::restore);
+    nvgRestore(ctx);
+  }
+  
   void update_font_offset()
   {
     // due to font format unconsistency,
@@ -336,22 +791,32 @@ struct glyph_positions {
   std::vector<NVGglyphPosition> positions;
 };
 
+enum class render_backend {
+  opengl, 
+  // no GPU nor window needed, see software_renderer
+  software
+};
+
 struct graphics_context 
 {
-  graphics_context();
+  /// With the OpenGL backend, an OpenGL context must be current. 
+  /// size is the initial size of the surface of the software backend.
+  graphics_context(render_backend backend = render_backend::opengl, vec2i size = {0, 0});
   
+  /// The positions of the glyphs of a text drawn left aligned at pos
   void get_glyph_positions(glyph_positions& p, std::string_view text, point pos, float font_size) const {
     nvgFontSize(ctx, font_size);
     update_font_offset();
-    p.positions.resize(text.size());
-    nvgTextGlyphPositions(ctx, pos.x, pos.y, text.begin(), text.end(), p.positions.data(), (int)(p.positions.size()) );
+    auto& layout = texts.get(ctx, current_font, font_size, text, true);
+    p.positions.resize(layout.positions.size());
+    for (std::size_t k = 0; k < p.positions.size(); ++k) {
+      auto& g = layout.positions[k];
+      p.positions[k] = {text.data() + (g.str - layout.str.data()), g.x + pos.x, g.minx + pos.x, g.maxx + pos.x};
+    }
   }
 
   point text_bounds(std::string_view str, int font_size) const {
-    nvgFontSize(ctx, font_size);
-    float bounds[4];
-    nvgTextBounds(ctx, 0, 0, str.data(), str.end(), bounds);
-    return vec2f{ bounds[2] - bounds[0], bounds[3] - bounds[1] };
+    return texts.get(ctx, current_font, font_size, str).bounds;
   }
   
   float text_height(int font_size) const {
@@ -381,12 +846,45 @@ struct graphics_context
 
   void set_font(const std::string& ident){
     nvgFontFace(ctx, ident.c_str());
+    current_font = nvgFindFont(ctx, ident.c_str());
     update_font_offset();
   }
   
-  painter painter() { return {ctx, text_vert_offset}; }
+  painter painter() { 
+    struct painter res {ctx, text_vert_offset};
+    res.software = software.get();
+    res.texts = &texts;
+    res.current_font = current_font;
+    res.pending_rasters = &pending_rasters;
+    res.graphics = this;
+    return res;
+  }
   
-  private : 
+  /// Paint the rasterized paint caches recorded since the last call in their layers, 
+  /// which must be done before the frame of the window begins
+  void paint_rasterized_caches();
+  
+  /// The surface painted by the software backend, null with OpenGL
+  software_renderer* software_target() { return software.get(); }
+  
+  /// Bind the retained frame buffer, which keeps its content between frames so that
+  /// only the damaged parts of a frame need to be repainted.
+  /// Return false if the buffer was (re)created and must be repainted entirely.
+  bool bind_retained_frame(vec2i size);
+  
+  /// Copy the retained frame buffer to the window frame buffer.
+  void present_retained_frame();
+  
+  /// Bind the frame buffer of a layer, (re)created if its size changed, clear it and begin 
+  /// a frame in it. Layers must be painted before the frame of the window begins.
+  void begin_layer(render_layer& l, vec2i size);
+  
+  /// End the frame of a layer and bind back the previous frame buffer
+  void end_layer(render_layer& l);
+  
+  void delete_layer(render_layer& l);
+  
+  private :
   
   void update_font_offset() const 
   {
@@ -399,8 +897,21 @@ struct graphics_context
     text_vert_offset = (a > h) ? a - h : 0;
   }
   
+  std::unique_ptr<software_renderer> software;
   NVGcontext* ctx = nullptr;
   mutable float text_vert_offset;
+  mutable text_cache texts;
+  int current_font = 0;
+  NVGLUframebuffer* retained_frame = nullptr;
+  vec2i retained_frame_size {0, 0};
+  int layer_saved_fbo = 0;
+  int layer_saved_viewport[4] = {};
+  std::vector<std::weak_ptr<impl::cache_raster>> pending_rasters;
 };
 
+inline impl::cache_raster::~cache_raster() {
+  if (graphics)
+    graphics->delete_layer(layer);
+}
+
 } // weave
\ No newline at end of file
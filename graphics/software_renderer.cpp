@@ -0,0 +1,489 @@
+#include "software_renderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <bit>
+#include <cstring>
+#include <cassert>
+
+namespace weave {
+
+namespace {
+  
+  constexpr int samples = 4;
+  
+  struct premul_color { float r, g, b, a; };
+  
+  premul_color premultiplied(NVGcolor c) {
+    return {c.r * c.a, c.g * c.a, c.b * c.a, c.a};
+  }
+  
+  premul_color mix(premul_color a, premul_color b, float t) {
+    return {a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t, a.a + (b.a - a.a) * t};
+  }
+  
+  premul_color operator*(premul_color a, premul_color b) {
+    return {a.r * b.r, a.g * b.g, a.b * b.b, a.a * b.a};
+  }
+  
+  void blend(float* dst, premul_color c, float coverage) {
+    auto k = 1 - c.a * coverage;
+    dst[0] = c.r * coverage + dst[0] * k;
+    dst[1] = c.g * coverage + dst[1] * k;
+    dst[2] = c.b * coverage + dst[2] * k;
+    dst[3] = c.a * coverage + dst[3] * k;
+  }
+  
+  void transform_point(const float* t, float x, float y, float& ox, float& oy) {
+    ox = x * t[0] + y * t[2] + t[4];
+    oy = x * t[1] + y * t[3] + t[5];
+  }
+  
+  // signed distance to a rounded rectangle centered on the origin, as in the shaders of nanovg
+  float sdroundrect(float px, float py, float ex, float ey, float r) {
+    float dx = std::abs(px) - (ex - r);
+    float dy = std::abs(py) - (ey - r);
+    return std::min(std::max(dx, dy), 0.f) + std::hypot(std::max(dx, 0.f), std::max(dy, 0.f)) - r;
+  }
+  
+  float edge(const NVGvertex& a, const NVGvertex& b, float px, float py) {
+    return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+  }
+  
+  /// Set the bits of the samples inside a triangle, the mask covers [x0, x0 + w) x [y0, y0 + h)
+  void rasterize_triangle(std::uint16_t* mask, int x0, int y0, int w, int h,
+                          const NVGvertex& a, const NVGvertex& b, const NVGvertex& c)
+  {
+    auto area = edge(a, b, c.x, c.y);
+    if (area == 0)
+      return;
+    auto sign = area > 0 ? 1.f : -1.f;
+    int xa = std::max(x0, (int)std::floor(std::min({a.x, b.x, c.x})));
+    int xb = std::min(x0 + w, (int)std::ceil(std::max({a.x, b.x, c.x})));
+    int ya = std::max(y0, (int)std::floor(std::min({a.y, b.y, c.y})));
+    int yb = std::min(y0 + h, (int)std::ceil(std::max({a.y, b.y, c.y})));
+    for (int y = ya; y < yb; ++y)
+      for (int x = xa; x < xb; ++x) {
+        std::uint16_t bits = 0;
+        for (int sy = 0; sy < samples; ++sy)
+          for (int sx = 0; sx < samples; ++sx) {
+            float px = x + (sx + 0.5f) / samples;
+            float py = y + (sy + 0.5f) / samples;
+            if (sign * edge(a, b, px, py) >= 0 && sign * edge(b, c, px, py) >= 0
+                && sign * edge(c, a, px, py) >= 0)
+              bits |= 1 << (sy * samples + sx);
+          }
+        mask[(y - y0) * w + (x - x0)] |= bits;
+      }
+  }
+
+} // namespace
+
+struct software_renderer::paint_sampler {
+  
+  paint_sampler(software_renderer& r, const NVGpaint& paint, const NVGscissor& scissor, float fringe)
+  : inner{premultiplied(paint.innerColor)}, outer{premultiplied(paint.outerColor)},
+    extent{paint.extent[0], paint.extent[1]}, radius{paint.radius}, feather{paint.feather}
+  {
+    nvgTransformInverse(paint_inv, paint.xform);
+    tex = paint.image ? r.find_texture(paint.image) : nullptr;
+    solid = !tex && std::memcmp(&inner, &outer, sizeof(inner)) == 0;
+    // nanovg marks a reset scissor with a negative extent
+    has_scissor = scissor.extent[0] >= -0.5f;
+    if (has_scissor) {
+      nvgTransformInverse(scissor_inv, scissor.xform);
+      scissor_ext[0] = scissor.extent[0];
+      scissor_ext[1] = scissor.extent[1];
+      auto* x = scissor.xform;
+      scissor_scale[0] = std::sqrt(x[0] * x[0] + x[2] * x[2]) / fringe;
+      scissor_scale[1] = std::sqrt(x[1] * x[1] + x[3] * x[3]) / fringe;
+    }
+  }
+  
+  float scissor_at(float x, float y) const {
+    if (!has_scissor)
+      return 1;
+    float sx, sy;
+    transform_point(scissor_inv, x, y, sx, sy);
+    sx = 0.5f - (std::abs(sx) - scissor_ext[0]) * scissor_scale[0];
+    sy = 0.5f - (std::abs(sy) - scissor_ext[1]) * scissor_scale[1];
+    return std::clamp(sx, 0.f, 1.f) * std::clamp(sy, 0.f, 1.f);
+  }
+  
+  premul_color texel(int x, int y) const {
+    auto [w, h] = tex->size;
+    x = (tex->flags & NVG_IMAGE_REPEATX) ? ((x % w) + w) % w : std::clamp(x, 0, w - 1);
+    y = (tex->flags & NVG_IMAGE_REPEATY) ? ((y % h) + h) % h : std::clamp(y, 0, h - 1);
+    if (tex->type == NVG_TEXTURE_ALPHA) {
+      auto a = tex->data[y * w + x] / 255.f;
+      return {a, a, a, a};
+    }
+    auto* p = tex->data.data() + (y * w + x) * 4;
+    premul_color c {p[0] / 255.f, p[1] / 255.f, p[2] / 255.f, p[3] / 255.f};
+    if (!(tex->flags & NVG_IMAGE_PREMULTIPLIED))
+      c = {c.r * c.a, c.g * c.a, c.b * c.a, c.a};
+    return c;
+  }
+  
+  /// Sample the texture at normalized coordinates
+  premul_color sample(float u, float v) const {
+    if (tex->flags & NVG_IMAGE_FLIPY)
+      v = 1 - v;
+    auto fx = u * tex->size.x;
+    auto fy = v * tex->size.y;
+    if (tex->flags & NVG_IMAGE_NEAREST)
+      return texel((int)std::floor(fx), (int)std::floor(fy));
+    fx -= 0.5f;
+    fy -= 0.5f;
+    int x = (int)std::floor(fx);
+    int y = (int)std::floor(fy);
+    auto tx = fx - x;
+    auto ty = fy - y;
+    auto top = mix(texel(x, y), texel(x + 1, y), tx);
+    auto bottom = mix(texel(x, y + 1), texel(x + 1, y + 1), tx);
+    return mix(top, bottom, ty);
+  }
+  
+  /// The color of the paint at a point of the target
+  premul_color at(float x, float y) const {
+    if (solid)
+      return inner;
+    float px, py;
+    transform_point(paint_inv, x, y, px, py);
+    if (tex)
+      return sample(px / extent[0], py / extent[1]) * inner;
+    auto d = std::clamp((sdroundrect(px, py, extent[0], extent[1], radius) + feather * 0.5f) / feather, 0.f, 1.f);
+    return mix(inner, outer, d);
+  }
+  
+  /// The color of the paint for texture coordinates given by the vertices
+  premul_color at_uv(float u, float v) const {
+    return tex ? sample(u, v) * inner : inner;
+  }
+  
+  premul_color inner, outer;
+  float extent[2], radius, feather;
+  float paint_inv[6];
+  const texture* tex;
+  bool solid;
+  bool has_scissor;
+  float scissor_inv[6];
+  float scissor_ext[2];
+  float scissor_scale[2];
+};
+
+struct software_renderer::callbacks {
+  
+  static software_renderer& self(void* p) { return *static_cast<software_renderer*>(p); }
+  
+  static int create(void*) { return 1; }
+  
+  static int create_texture(void* p, int type, int w, int h, int flags, const unsigned char* data) {
+    auto& r = self(p);
+    auto it = std::ranges::find_if(r.textures, [] (auto& t) { return t.type == 0; });
+    auto& t = it != r.textures.end() ? *it : r.textures.emplace_back();
+    t.type = type;
+    t.flags = flags;
+    t.size = {w, h};
+    auto bytes = (std::size_t)w * h * (type == NVG_TEXTURE_RGBA ? 4 : 1);
+    t.data.assign(bytes, 0);
+    if (data)
+      std::memcpy(t.data.data(), data, bytes);
+    // Note : 0 is the null image for nanovg
+    return (int)(&t - r.textures.data()) + 1;
+  }
+  
+  static int delete_texture(void* p, int image) {
+    auto* t = self(p).find_texture(image);
+    if (!t)
+      return 0;
+    *t = texture{};
+    return 1;
+  }
+  
+  // Note : data is the whole image, of which only a region is updated
+  static int update_texture(void* p, int image, int x, int y, int w, int h, const unsigned char* data) {
+    auto* t = self(p).find_texture(image);
+    if (!t)
+      return 0;
+    auto bpp = t->type == NVG_TEXTURE_RGBA ? 4 : 1;
+    auto stride = t->size.x * bpp;
+    for (int row = y; row < y + h; ++row)
+      std::memcpy(t->data.data() + row * stride + x * bpp, data + row * stride + x * bpp, w * bpp);
+    return 1;
+  }
+  
+  static int texture_size(void* p, int image, int* w, int* h) {
+    auto* t = self(p).find_texture(image);
+    if (!t)
+      return 0;
+    *w = t->size.x;
+    *h = t->size.y;
+    return 1;
+  }
+  
+  static void viewport(void*, float, float, float) {}
+  
+  static void cancel(void*) {}
+  
+  static void flush(void*) {}
+  
+  static void fill(void* p, NVGpaint* paint, NVGcompositeOperationState, NVGscissor* scissor,
+                   float fringe, const float* bounds, const NVGpath* paths, int npaths) {
+    self(p).fill_paths(*paint, *scissor, fringe, bounds, paths, npaths);
+  }
+  
+  static void stroke(void* p, NVGpaint* paint, NVGcompositeOperationState, NVGscissor* scissor,
+                     float fringe, float, const NVGpath* paths, int npaths) {
+    self(p).stroke_paths(*paint, *scissor, fringe, paths, npaths);
+  }
+  
+  static void triangles(void* p, NVGpaint* paint, NVGcompositeOperationState, NVGscissor* scissor,
+                        const NVGvertex* verts, int nverts, float fringe) {
+    self(p).fill_triangles(*paint, *scissor, fringe, verts, nverts);
+  }
+  
+  static void destroy(void*) {}
+};
+
+software_renderer::software_renderer(vec2i size)
+{
+  resize(size);
+}
+
+NVGcontext* software_renderer::create_context()
+{
+  NVGparams params;
+  std::memset(&params, 0, sizeof(params));
+  params.userPtr = this;
+  // antialiasing is done by supersampling, so nanovg doesn't need to add fringes to the shapes
+  params.edgeAntiAlias = 0;
+  params.renderCreate = &callbacks::create;
+  params.renderCreateTexture = &callbacks::create_texture;
+  params.renderDeleteTexture = &callbacks::delete_texture;
+  params.renderUpdateTexture = &callbacks::update_texture;
+  params.renderGetTextureSize = &callbacks::texture_size;
+  params.renderViewport = &callbacks::viewport;
+  params.renderCancel = &callbacks::cancel;
+  params.renderFlush = &callbacks::flush;
+  params.renderFill = &callbacks::fill;
+  params.renderStroke = &callbacks::stroke;
+  params.renderTriangles = &callbacks::triangles;
+  params.renderDelete = &callbacks::destroy;
+  return nvgCreateInternal(&params);
+}
+
+void software_renderer::resize(vec2i size)
+{
+  main.size = size;
+  main.pixels.assign((std::size_t)size.x * size.y * 4, 0.f);
+}
+
+void software_renderer::clear(rgba_f color, rectangle region)
+{
+  auto& s = *target;
+  int x0 = std::max(0, (int)std::floor(region.origin.x));
+  int y0 = std::max(0, (int)std::floor(region.origin.y));
+  int x1 = std::min(s.size.x, (int)std::ceil(region.origin.x + region.size.x));
+  int y1 = std::min(s.size.y, (int)std::ceil(region.origin.y + region.size.y));
+  auto a = color.alpha;
+  float c[4] = {color.col[0] * a, color.col[1] * a, color.col[2] * a, a};
+  for (int y = y0; y < y1; ++y)
+    for (int x = x0; x < x1; ++x)
+      std::memcpy(s.pixels.data() + (y * s.size.x + x) * 4, c, sizeof(c));
+}
+
+int software_renderer::create_render_target(vec2i size)
+{
+  return callbacks::create_texture(this, NVG_TEXTURE_RGBA, size.x, size.y, NVG_IMAGE_PREMULTIPLIED, nullptr);
+}
+
+void software_renderer::bind_render_target(int image)
+{
+  flush_render_target();
+  if (!image) {
+    target = &main;
+    layer_image = 0;
+    return;
+  }
+  auto* t = find_texture(image);
+  assert( t && t->type == NVG_TEXTURE_RGBA && "not a render target" );
+  layer.size = t->size;
+  layer.pixels.resize(t->data.size());
+  for (std::size_t k = 0; k < t->data.size(); ++k)
+    layer.pixels[k] = t->data[k] / 255.f;
+  target = &layer;
+  layer_image = image;
+}
+
+void software_renderer::flush_render_target()
+{
+  if (!layer_image)
+    return;
+  if (auto* t = find_texture(layer_image))
+    for (std::size_t k = 0; k < t->data.size(); ++k)
+      t->data[k] = (unsigned char)std::lround(std::clamp(layer.pixels[k], 0.f, 1.f) * 255);
+}
+
+image<rgba<unsigned char>> software_renderer::read_pixels() const
+{
+  auto [w, h] = main.size;
+  image<rgba<unsigned char>> res {vec2i{h, w}};
+  auto to_byte = [] (float v) { return (unsigned char)std::lround(std::clamp(v, 0.f, 1.f) * 255); };
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x) {
+      auto* p = main.pixels.data() + (y * w + x) * 4;
+      auto a = p[3];
+      auto k = a > 0 ? 1 / a : 0.f;
+      res(y, x) = rgba<unsigned char>{{to_byte(p[0] * k), to_byte(p[1] * k), to_byte(p[2] * k)}, to_byte(a)};
+    }
+  return res;
+}
+
+software_renderer::texture* software_renderer::find_texture(int image)
+{
+  if (image <= 0 || image > (int)textures.size() || textures[image - 1].type == 0)
+    return nullptr;
+  return &textures[image - 1];
+}
+
+void software_renderer::fill_paths(const NVGpaint& paint, const NVGscissor& scissor, float fringe,
+                                   const float* bounds, const NVGpath* paths, int npaths)
+{
+  int x0 = std::max(0, (int)std::floor(bounds[0]));
+  int y0 = std::max(0, (int)std::floor(bounds[1]));
+  int x1 = std::min(target->size.x, (int)std::ceil(bounds[2]));
+  int y1 = std::min(target->size.y, (int)std::ceil(bounds[3]));
+  if (x0 >= x1 || y0 >= y1)
+    return;
+  int w = x1 - x0;
+  int h = y1 - y0;
+  mask.assign((std::size_t)w * h, 0);
+  
+  // Scanline fill of every path at once with the nonzero rule, like the stencil fill of nanovg
+  for (int y = y0; y < y1; ++y)
+    for (int sy = 0; sy < samples; ++sy) {
+      float ys = y + (sy + 0.5f) / samples;
+      crossings.clear();
+      for (int k = 0; k < npaths; ++k) {
+        auto& path = paths[k];
+        for (int i = 0; i < path.nfill; ++i) {
+          auto& a = path.fill[i];
+          auto& b = path.fill[(i + 1) % path.nfill];
+          if ((a.y <= ys) != (b.y <= ys))
+            crossings.push_back({a.x + (ys - a.y) * (b.x - a.x) / (b.y - a.y), b.y > a.y ? 1 : -1});
+        }
+      }
+      std::ranges::sort(crossings);
+      int winding = 0;
+      for (std::size_t k = 0; k + 1 < crossings.size(); ++k) {
+        winding += crossings[k].second;
+        if (!winding)
+          continue;
+        // the samples whose center is in [xa, xb)
+        int s0 = std::max(x0 * samples, (int)std::ceil(crossings[k].first * samples - 0.5f));
+        int s1 = std::min(x1 * samples, (int)std::ceil(crossings[k + 1].first * samples - 0.5f));
+        for (int s = s0; s < s1; ++s)
+          mask[(y - y0) * w + (s / samples - x0)] |= 1 << (sy * samples + s % samples);
+      }
+    }
+  
+  blend_mask(paint_sampler{*this, paint, scissor, fringe}, x0, y0, w, h);
+}
+
+void software_renderer::stroke_paths(const NVGpaint& paint, const NVGscissor& scissor, float fringe,
+                                     const NVGpath* paths, int npaths)
+{
+  float minx = 1e30f, miny = 1e30f, maxx = -1e30f, maxy = -1e30f;
+  for (int k = 0; k < npaths; ++k)
+    for (int i = 0; i < paths[k].nstroke; ++i) {
+      auto& v = paths[k].stroke[i];
+      minx = std::min(minx, v.x);
+      miny = std::min(miny, v.y);
+      maxx = std::max(maxx, v.x);
+      maxy = std::max(maxy, v.y);
+    }
+  int x0 = std::max(0, (int)std::floor(minx));
+  int y0 = std::max(0, (int)std::floor(miny));
+  int x1 = std::min(target->size.x, (int)std::ceil(maxx));
+  int y1 = std::min(target->size.y, (int)std::ceil(maxy));
+  if (x0 >= x1 || y0 >= y1)
+    return;
+  int w = x1 - x0;
+  int h = y1 - y0;
+  mask.assign((std::size_t)w * h, 0);
+  
+  // Strokes are triangle strips, the union of their samples is blended once
+  // so that overlapping parts are not blended twice
+  for (int k = 0; k < npaths; ++k) {
+    auto* v = paths[k].stroke;
+    for (int i = 0; i + 2 < paths[k].nstroke; ++i)
+      rasterize_triangle(mask.data(), x0, y0, w, h, v[i], v[i + 1], v[i + 2]);
+  }
+  
+  blend_mask(paint_sampler{*this, paint, scissor, fringe}, x0, y0, w, h);
+}
+
+void software_renderer::fill_triangles(const NVGpaint& paint, const NVGscissor& scissor, float fringe,
+                                       const NVGvertex* verts, int nverts)
+{
+  auto sampler = paint_sampler{*this, paint, scissor, fringe};
+  auto& s = *target;
+  
+  // Pixel centers only : these are the quads of glyphs, whose edges are transparent
+  for (int i = 0; i + 2 < nverts; i += 3) {
+    auto a = verts[i], b = verts[i + 1], c = verts[i + 2];
+    auto area = edge(a, b, c.x, c.y);
+    if (area == 0)
+      continue;
+    if (area < 0) {
+      std::swap(b, c);
+      area = -area;
+    }
+    // A pixel center on an edge shared by two triangles belongs to only one of them
+    auto inside = [] (float e, const NVGvertex& p, const NVGvertex& q) {
+      auto dx = q.x - p.x;
+      auto dy = q.y - p.y;
+      return e > 0 || (e == 0 && (dy > 0 || (dy == 0 && dx > 0)));
+    };
+    int xa = std::max(0, (int)std::floor(std::min({a.x, b.x, c.x})));
+    int xb = std::min(s.size.x, (int)std::ceil(std::max({a.x, b.x, c.x})));
+    int ya = std::max(0, (int)std::floor(std::min({a.y, b.y, c.y})));
+    int yb = std::min(s.size.y, (int)std::ceil(std::max({a.y, b.y, c.y})));
+    for (int y = ya; y < yb; ++y)
+      for (int x = xa; x < xb; ++x) {
+        float px = x + 0.5f;
+        float py = y + 0.5f;
+        auto w0 = edge(b, c, px, py);
+        auto w1 = edge(c, a, px, py);
+        auto w2 = edge(a, b, px, py);
+        if (!inside(w0, b, c) || !inside(w1, c, a) || !inside(w2, a, b))
+          continue;
+        auto cov = sampler.scissor_at(px, py);
+        if (cov <= 0)
+          continue;
+        auto u = (w0 * a.u + w1 * b.u + w2 * c.u) / area;
+        auto v = (w0 * a.v + w1 * b.v + w2 * c.v) / area;
+        blend(s.pixels.data() + (y * s.size.x + x) * 4, sampler.at_uv(u, v), cov);
+      }
+  }
+}
+
+void software_renderer::blend_mask(const paint_sampler& paint, int x0, int y0, int w, int h)
+{
+  auto& s = *target;
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x) {
+      auto bits = mask[y * w + x];
+      if (!bits)
+        continue;
+      float px = x0 + x + 0.5f;
+      float py = y0 + y + 0.5f;
+      auto cov = std::popcount(bits) / float(samples * samples) * paint.scissor_at(px, py);
+      if (cov <= 0)
+        continue;
+      blend(s.pixels.data() + ((y0 + y) * s.size.x + x0 + x) * 4, paint.at(px, py), cov);
+    }
+}
+
+} // weave
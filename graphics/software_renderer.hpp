@@ -0,0 +1,103 @@
+#pragma once
+
+#include "color.hpp"
+#include "image.hpp"
+#include "../geometry/geometry.hpp"
+#include "util/vec.hpp"
+
+#include "nanovg.h"
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+namespace weave {
+
+/// A CPU rasterizer behind the render interface of nanovg, which paints into memory.
+/// It lets a graphics_context run without GPU nor window, eg. for tests, screenshots
+/// or benchmarks on headless machines.
+/// Shapes are antialiased with 4x4 supersampling, and colors are blended as premultiplied
+/// floats with the source over operator.
+struct software_renderer {
+  
+  explicit software_renderer(vec2i size);
+  
+  software_renderer(const software_renderer&) = delete;
+  software_renderer& operator=(const software_renderer&) = delete;
+  
+  /// Create a nanovg context painting with this renderer, to be deleted with nvgDeleteInternal
+  /// before the renderer.
+  NVGcontext* create_context();
+  
+  vec2i size() const { return main.size; }
+  
+  /// Resize the main surface, its content is cleared
+  void resize(vec2i size);
+  
+  /// Set every pixel of a region of the current target to a color, without blending
+  void clear(rgba_f color, rectangle region);
+  
+  void clear(rgba_f color) {
+    clear(color, rectangle{point{(float)target->size.x, (float)target->size.y}});
+  }
+  
+  /// Create a texture which can be painted into, see bind_render_target
+  int create_render_target(vec2i size);
+  
+  /// Paint into a texture created by create_render_target, or into the main surface if image is 0.
+  /// The content of the texture is updated when another target is bound.
+  void bind_render_target(int image);
+  
+  /// A copy of the main surface
+  image<rgba<unsigned char>> read_pixels() const;
+  
+  private :
+  
+  // the nanovg callbacks, defined with the implementation
+  struct callbacks;
+  
+  struct texture {
+    int type = 0;
+    int flags = 0;
+    vec2i size {0, 0};
+    std::vector<unsigned char> data;
+  };
+  
+  /// Premultiplied RGBA pixels, row by row
+  struct surface {
+    vec2i size {0, 0};
+    std::vector<float> pixels;
+  };
+  
+  /// The color of a paint at a point, premultiplied
+  struct paint_sampler;
+  
+  texture* find_texture(int image);
+  
+  void flush_render_target();
+  
+  void fill_paths(const NVGpaint& paint, const NVGscissor& scissor, float fringe,
+                  const float* bounds, const NVGpath* paths, int npaths);
+  
+  void stroke_paths(const NVGpaint& paint, const NVGscissor& scissor, float fringe,
+                    const NVGpath* paths, int npaths);
+  
+  void fill_triangles(const NVGpaint& paint, const NVGscissor& scissor, float fringe,
+                      const NVGvertex* verts, int nverts);
+  
+  /// Blend the paint over the target where the sample mask is set,
+  /// the mask covers the pixels [x0, x0 + w) x [y0, y0 + h)
+  void blend_mask(const paint_sampler& paint, int x0, int y0, int w, int h);
+  
+  surface main;
+  surface layer;
+  surface* target = &main;
+  int layer_image = 0;
+  std::vector<texture> textures;
+  // one bit per sample, 4x4 samples per pixel
+  std::vector<std::uint16_t> mask;
+  // the edges crossing a row of samples, and their direction
+  std::vector<std::pair<float, int>> crossings;
+};
+
+} // weave
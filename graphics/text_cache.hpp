@@ -0,0 +1,168 @@
+#pragma once
+
+#include "util/vec.hpp"
+
+#include "nanovg.h"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include <bit>
+
+namespace weave {
+
+/// The measures of a string drawn with a font and a size
+struct text_layout {
+  
+  /// The size of the bounding box of the text
+  vec2f bounds {0, 0};
+  /// The horizontal advance of the text, which nanovg uses to align it
+  float advance = 0;
+  /// The glyphs of the text drawn left aligned at the origin, their str point into str
+  std::vector<NVGglyphPosition> positions;
+  bool has_positions = false;
+  
+  /// The last truncation computed by painter::text_bounded : the number of bytes
+  /// displayed before the ellipsis in a box of width truncated_width
+  float truncated_width = -1;
+  std::size_t truncated_index = 0;
+  
+  std::string str;
+  int font = 0;
+  float font_size = 0;
+  
+  private :
+  
+  friend struct text_cache;
+  
+  std::uint64_t key = 0;
+  int prev = -1, next = -1;
+};
+
+/// A least recently used cache of the measures of strings, so that the strings painted
+/// or measured every frame are shaped by nanovg only once.
+/// Lookups don't allocate, and the storage of evicted entries is reused.
+struct text_cache {
+  
+  explicit text_cache(std::size_t capacity = 1024) {
+    entries.resize(capacity);
+    map.reserve(capacity);
+  }
+  
+  /// The measures of a string, computed on a miss. The reference is valid until the next call.
+  text_layout& get(NVGcontext* ctx, int font, float font_size, std::string_view str,
+                   bool with_positions = false)
+  {
+    auto key = hash(font, font_size, str);
+    auto it = map.find(key);
+    bool found = it != map.end();
+    int idx;
+    if (found) {
+      idx = it->second;
+      unlink(idx);
+    }
+    else
+      idx = acquire(key);
+    link_front(idx);
+    
+    auto& e = entries[idx];
+    // a collision of hashes is a miss, which replaces the entry
+    if (!found || e.font != font || e.font_size != font_size || e.str != str) {
+      e.str = str;
+      e.font = font;
+      e.font_size = font_size;
+      e.has_positions = false;
+      e.truncated_width = -1;
+      measure(ctx, e, false);
+    }
+    if (with_positions && !e.has_positions)
+      measure(ctx, e, true);
+    return e;
+  }
+  
+  std::size_t size() const { return map.size(); }
+  
+  std::size_t capacity() const { return entries.size(); }
+  
+  void clear() {
+    map.clear();
+    used = 0;
+    head = tail = -1;
+  }
+  
+  private :
+  
+  static std::uint64_t hash(int font, float font_size, std::string_view str) {
+    std::uint64_t h = std::hash<std::string_view>{}(str);
+    std::uint64_t k = std::bit_cast<std::uint32_t>(font_size) | ((std::uint64_t)(std::uint32_t)font << 32);
+    k *= 0x9E3779B97F4A7C15ull;
+    return h ^ (k ^ (k >> 29));
+  }
+  
+  // Measure with a neutral state, so that the result doesn't depend on the alignment
+  static void measure(NVGcontext* ctx, text_layout& e, bool with_positions) {
+    auto* begin = e.str.data();
+    auto* end = begin + e.str.size();
+    nvgSave(ctx);
+    nvgFontFaceId(ctx, e.font);
+    nvgFontSize(ctx, e.font_size);
+    nvgTextAlign(ctx, NVG_ALIGN_LEFT | NVG_ALIGN_BASELINE);
+    if (with_positions) {
+      e.positions.resize(e.str.size());
+      auto n = nvgTextGlyphPositions(ctx, 0, 0, begin, end, e.positions.data(), (int)e.positions.size());
+      e.positions.resize(n);
+      e.has_positions = true;
+    }
+    else {
+      float b[4];
+      e.advance = nvgTextBounds(ctx, 0, 0, begin, end, b);
+      e.bounds = vec2f{b[2] - b[0], b[3] - b[1]};
+    }
+    nvgRestore(ctx);
+  }
+  
+  // A free entry, or the least recently used one, registered under key
+  int acquire(std::uint64_t key) {
+    int idx;
+    if (used < (int)entries.size())
+      idx = used++;
+    else {
+      idx = tail;
+      unlink(idx);
+      map.erase(entries[idx].key);
+    }
+    entries[idx].key = key;
+    map.emplace(key, idx);
+    return idx;
+  }
+  
+  void unlink(int idx) {
+    auto& e = entries[idx];
+    (e.prev >= 0 ? entries[e.prev].next : head) = e.next;
+    (e.next >= 0 ? entries[e.next].prev : tail) = e.prev;
+    e.prev = e.next = -1;
+  }
+  
+  void link_front(int idx) {
+    auto& e = entries[idx];
+    e.prev = -1;
+    e.next = head;
+    if (head >= 0)
+      entries[head].prev = idx;
+    head = idx;
+    if (tail < 0)
+      tail = idx;
+  }
+  
+  // Note : entries never move, since the glyph positions point into their string
+  std::vector<text_layout> entries;
+  std::unordered_map<std::uint64_t, int> map;
+  int used = 0;
+  // the most and least recently used entries
+  int head = -1, tail = -1;
+};
+
+} // weave
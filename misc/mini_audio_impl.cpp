@@ -11,6 +11,22 @@
 #include "dr_flac.h"
 #include "dr_wav.h"
 
+#include <filesystem>
+#include <fstream>
+#include <format>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 std::optional<weave::audio_buffer> weave::read_audio_file(const std::string& path) 
 {
   if (path.ends_with(".mp3"))
@@ -28,14 +44,23 @@ std::optional<weave::audio_buffer> weave::read_audio_file(const std::string& pat
       auto framesJustRead = drmp3_read_pcm_frames_f32(&mp3, std::size(Temp) / mp3.channels, Temp);
       if (framesJustRead == 0)
         break;
-      vec.append_range(Temp);
+      vec.append_range(std::span{Temp, framesJustRead * mp3.channels});
     }
 
     return audio_buffer{vec, (int)mp3.channels};
   }
   else if (path.ends_with(".flac"))
   {
-    return {};
+    unsigned channels;
+    unsigned sample_rate;
+    drflac_uint64 num_frames;
+    float* data = drflac_open_file_and_read_pcm_frames_f32(path.c_str(), &channels, &sample_rate, 
+                                                            &num_frames, nullptr);
+    if (!data)
+      return {};
+    auto dtor = on_exit( [&] () { drflac_free(data, nullptr); } );
+    std::vector<float> vec {data, data + num_frames * channels};
+    return audio_buffer{vec, (int)channels};
   }
   else // Default ot wav if all else fails 
   {
@@ -49,4 +74,604 @@ std::optional<weave::audio_buffer> weave::read_audio_file(const std::string& pat
     drwav_read_pcm_frames_f32(&wav, wav.totalPCMFrameCount, vec.data());
     return audio_buffer{vec, (int)wav.channels};
   }
+}
+
+struct weave::audio_file_reader::decoder {
+  
+  virtual ~decoder() = default;
+  
+  // returns the number of frames read
+  virtual std::size_t read(float* out, std::size_t frames) = 0;
+  virtual bool seek(std::uint64_t frame) = 0;
+  // may be slow, called from the decoding thread
+  virtual std::uint64_t count_frames() = 0;
+  
+  int channels = 0;
+  int sample_rate = 0;
+};
+
+namespace {
+  
+  struct mp3_decoder : weave::audio_file_reader::decoder {
+    
+    bool open(const std::string& p) {
+      path = p;
+      if (!drmp3_init_file(&mp3, path.c_str(), nullptr))
+        return false;
+      channels = mp3.channels;
+      sample_rate = mp3.sampleRate;
+      return true;
+    }
+    
+    ~mp3_decoder() { drmp3_uninit(&mp3); }
+    
+    std::size_t read(float* out, std::size_t frames) override {
+      return drmp3_read_pcm_frames_f32(&mp3, frames, out);
+    }
+    
+    bool seek(std::uint64_t frame) override {
+      return drmp3_seek_to_pcm_frame(&mp3, frame);
+    }
+    
+    // Note : counting the frames of a mp3 requires going through the whole file, 
+    // so we use another decoder not to lose the current position
+    std::uint64_t count_frames() override {
+      drmp3 other;
+      if (!drmp3_init_file(&other, path.c_str(), nullptr))
+        return 0;
+      auto res = drmp3_get_pcm_frame_count(&other);
+      drmp3_uninit(&other);
+      return res;
+    }
+    
+    drmp3 mp3;
+    std::string path;
+  };
+  
+  struct flac_decoder : weave::audio_file_reader::decoder {
+    
+    bool open(const std::string& path) {
+      flac = drflac_open_file(path.c_str(), nullptr);
+      if (!flac)
+        return false;
+      channels = flac->channels;
+      sample_rate = flac->sampleRate;
+      return true;
+    }
+    
+    ~flac_decoder() { if (flac) drflac_close(flac); }
+    
+    std::size_t read(float* out, std::size_t frames) override {
+      return drflac_read_pcm_frames_f32(flac, frames, out);
+    }
+    
+    bool seek(std::uint64_t frame) override {
+      return drflac_seek_to_pcm_frame(flac, frame);
+    }
+    
+    std::uint64_t count_frames() override {
+      return flac->totalPCMFrameCount;
+    }
+    
+    drflac* flac = nullptr;
+  };
+  
+  struct wav_decoder : weave::audio_file_reader::decoder {
+    
+    bool open(const std::string& path) {
+      if (!drwav_init_file(&wav, path.c_str(), nullptr))
+        return false;
+      is_init = true;
+      channels = wav.channels;
+      sample_rate = wav.sampleRate;
+      return true;
+    }
+    
+    ~wav_decoder() { if (is_init) drwav_uninit(&wav); }
+    
+    std::size_t read(float* out, std::size_t frames) override {
+      return drwav_read_pcm_frames_f32(&wav, frames, out);
+    }
+    
+    bool seek(std::uint64_t frame) override {
+      return drwav_seek_to_pcm_frame(&wav, frame);
+    }
+    
+    std::uint64_t count_frames() override {
+      return wav.totalPCMFrameCount;
+    }
+    
+    drwav wav;
+    bool is_init = false;
+  };
+  
+  template <class D>
+  std::unique_ptr<weave::audio_file_reader::decoder> open_decoder(const std::string& path) {
+    auto res = std::make_unique<D>();
+    if (!res->open(path))
+      return nullptr;
+    return res;
+  }
+  
+  std::unique_ptr<weave::audio_file_reader::decoder> open_file_decoder(const std::string& path) {
+    if (path.ends_with(".mp3"))
+      return open_decoder<mp3_decoder>(path);
+    else if (path.ends_with(".flac"))
+      return open_decoder<flac_decoder>(path);
+    else
+      return open_decoder<wav_decoder>(path);
+  }
+}
+
+weave::audio_file_reader::audio_file_reader() = default;
+
+weave::audio_file_reader::~audio_file_reader() {
+  close();
+}
+
+bool weave::audio_file_reader::open(const std::string& path, int output_rate)
+{
+  close();
+  
+  dec = open_file_decoder(path);
+  if (!dec)
+    return false;
+  
+  num_channels_v = dec->channels;
+  sample_rate_v = dec->sample_rate;
+  output_rate_v = output_rate ? output_rate : sample_rate_v;
+  // two seconds of audio ahead
+  ring.reset(2 * output_rate_v * num_channels_v);
+  total_frames_v = 0;
+  position_v = 0;
+  position_base = 0;
+  frames_since_seek = 0;
+  decoded_all = false;
+  seek_request = -1;
+  discard_until = no_discard;
+  quit = false;
+  worker = std::thread{ [this] { decode_loop(); } };
+  return true;
+}
+
+void weave::audio_file_reader::close()
+{
+  if (worker.joinable()) {
+    quit = true;
+    worker.join();
+  }
+  dec.reset();
+  num_channels_v = 0;
+  sample_rate_v = 0;
+}
+
+std::size_t weave::audio_file_reader::read(std::span<float> out)
+{
+  if (!is_open())
+    return 0;
+  
+  // Drop what was decoded before the last seek
+  auto d = discard_until.exchange(no_discard, std::memory_order_acquire);
+  if (d != no_discard) {
+    ring.discard_until(d);
+    position_base = seek_frame.load(std::memory_order_relaxed);
+    frames_since_seek = 0;
+  }
+  
+  auto frames = ring.read(out.first(out.size() - out.size() % num_channels_v)) / num_channels_v;
+  frames_since_seek += frames;
+  position_v.store(position_base + frames_since_seek * sample_rate_v / output_rate_v, 
+                   std::memory_order_relaxed);
+  return frames;
+}
+
+void weave::audio_file_reader::seek(std::uint64_t frame) 
+{
+  seek_request.store(frame, std::memory_order_relaxed);
+}
+
+void weave::audio_file_reader::decode_loop()
+{
+  using namespace std::chrono_literals;
+  
+  constexpr std::size_t chunk_frames = 4096;
+  std::vector<float> chunk(chunk_frames * num_channels_v);
+  
+  // Resampling is done here rather than in the audio thread
+  audio_resampler resampler;
+  std::vector<float> resampled;
+  if (output_rate_v != sample_rate_v) {
+    resampler.init(num_channels_v, sample_rate_v, output_rate_v);
+    resampled.resize((resampler.output_frames(chunk_frames) + 16) * num_channels_v);
+  }
+  auto& out = resampler.is_initialized() ? resampled : chunk;
+  
+  auto count_frames = [this, counted = false] () mutable {
+    if (!counted) {
+      total_frames_v.store(dec->count_frames(), std::memory_order_relaxed);
+      counted = true;
+    }
+  };
+  
+  while (!quit.load(std::memory_order_relaxed))
+  {
+    auto s = seek_request.exchange(-1, std::memory_order_relaxed);
+    if (s >= 0) {
+      dec->seek(s);
+      resampler.reset();
+      decoded_all = false;
+      seek_frame.store(s, std::memory_order_relaxed);
+      discard_until.store(ring.write_position(), std::memory_order_release);
+    }
+    
+    if (decoded_all || ring.free_space() < out.size()) {
+      // Nothing to do until the audio thread reads, 
+      // take this opportunity to do the expensive work
+      count_frames();
+      std::this_thread::sleep_for(5ms);
+      continue;
+    }
+    
+    auto frames = dec->read(chunk.data(), chunk_frames);
+    if (resampler.is_initialized()) {
+      auto r = resampler.process(std::span{chunk.data(), frames * num_channels_v}, resampled);
+      ring.write(std::span{resampled.data(), r.frames_written * num_channels_v});
+    }
+    else
+      ring.write(std::span{chunk.data(), frames * num_channels_v});
+    if (frames < chunk_frames)
+      decoded_all = true;
+  }
+}
+
+namespace {
+  
+  namespace fs = std::filesystem;
+  
+  // Followed by the path of the source file, then by the samples at data_offset()
+  struct pcm_cache_header {
+    char magic[4] = {'W', 'V', 'P', 'C'};
+    std::uint32_t version = 2;
+    std::uint32_t num_channels = 0;
+    std::uint32_t sample_rate = 0;
+    std::uint64_t num_frames = 0;
+    // the size and modification time of the source file when it was decoded
+    std::uint64_t source_size = 0;
+    std::int64_t source_time = 0;
+    std::uint32_t path_size = 0;
+    std::uint32_t reserved = 0;
+    
+    std::size_t data_offset() const {
+      return (sizeof(pcm_cache_header) + path_size + 15) & ~std::size_t(15);
+    }
+  };
+  
+  static_assert( sizeof(pcm_cache_header) == 48 );
+  
+  struct source_stamp {
+    std::uint64_t size;
+    std::int64_t time;
+  };
+  
+  weave::optional<source_stamp> stamp_of(const std::string& path)
+  {
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec)
+      return {};
+    auto time = fs::last_write_time(path, ec);
+    if (ec)
+      return {};
+    return source_stamp{size, (std::int64_t)time.time_since_epoch().count()};
+  }
+  
+  // True if an entry with this header and stored path is the decoded content of path.
+  // Note : the name of an entry is a hash, so two sources can share it
+  bool describes(const pcm_cache_header& header, std::string_view stored_path, 
+                 const std::string& path, source_stamp stamp)
+  {
+    return std::memcmp(header.magic, pcm_cache_header{}.magic, 4) == 0 
+           && header.version == pcm_cache_header{}.version
+           && header.num_channels != 0
+           && header.source_size == stamp.size
+           && header.source_time == stamp.time
+           && stored_path == path;
+  }
+  
+  // Map a whole file read only, returns nullptr on failure
+  void* map_file(const std::string& path, std::size_t& size)
+  {
+  #ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return nullptr;
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(file, &sz) || sz.QuadPart == 0) {
+      CloseHandle(file);
+      return nullptr;
+    }
+    size = sz.QuadPart;
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+      return nullptr;
+    // Note : the view keeps the mapping alive
+    void* res = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    return res;
+  #else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return nullptr;
+    }
+    size = st.st_size;
+    void* res = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    return res == MAP_FAILED ? nullptr : res;
+  #endif
+  }
+  
+  void unmap_file(void* base, std::size_t size)
+  {
+  #ifdef _WIN32
+    UnmapViewOfFile(base);
+  #else
+    munmap(base, size);
+  #endif
+  }
+}
+
+weave::mapped_audio& weave::mapped_audio::operator=(mapped_audio&& o)
+{
+  if (this == &o)
+    return *this;
+  if (base)
+    unmap_file(base, mapped_size);
+  base = std::exchange(o.base, nullptr);
+  mapped_size = std::exchange(o.mapped_size, 0);
+  data = std::exchange(o.data, {});
+  num_channels_v = std::exchange(o.num_channels_v, 0);
+  sample_rate_v = std::exchange(o.sample_rate_v, 0);
+  return *this;
+}
+
+weave::mapped_audio::~mapped_audio() {
+  if (base)
+    unmap_file(base, mapped_size);
+}
+
+weave::audio_file_cache::audio_file_cache(std::string directory, std::uint64_t max_bytes)
+: dir{std::move(directory)}, max_bytes{max_bytes}
+{
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+}
+
+weave::optional<std::string> weave::audio_file_cache::entry_path(const std::string& path) const
+{
+  auto stamp = stamp_of(path);
+  if (!stamp)
+    return {};
+  auto key = std::format("{}|{}|{}", path, stamp->size, stamp->time);
+  return (fs::path{dir} / std::format("{:016x}.pcm", std::hash<std::string>{}(key))).string();
+}
+
+bool weave::audio_file_cache::contains(const std::string& path) const
+{
+  auto entry = entry_path(path);
+  auto stamp = stamp_of(path);
+  if (!entry || !stamp)
+    return false;
+  
+  std::ifstream in {*entry, std::ios::binary};
+  pcm_cache_header header;
+  if (!in.read((char*)&header, sizeof(header)) || header.path_size != path.size())
+    return false;
+  std::string stored_path(header.path_size, '\0');
+  in.read(stored_path.data(), stored_path.size());
+  return in && describes(header, stored_path, path, *stamp);
+}
+
+bool weave::audio_file_cache::decode_to(const std::string& path, const std::string& entry)
+{
+  auto stamp = stamp_of(path);
+  auto dec = open_file_decoder(path);
+  if (!stamp || !dec)
+    return false;
+  
+  // Write to a temporary file first, so that other readers never see a partial entry
+  static std::atomic<unsigned> counter = 0;
+  auto tmp = std::format("{}.{}.{}.tmp", entry, 
+                         std::hash<std::thread::id>{}(std::this_thread::get_id()), counter++);
+  std::error_code ec;
+  {
+    std::ofstream out {tmp, std::ios::binary};
+    if (!out)
+      return false;
+    
+    pcm_cache_header header;
+    header.num_channels = dec->channels;
+    header.sample_rate = dec->sample_rate;
+    header.source_size = stamp->size;
+    header.source_time = stamp->time;
+    header.path_size = path.size();
+    out.write((const char*)&header, sizeof(header));
+    out.write(path.data(), path.size());
+    const char padding[16] = {};
+    out.write(padding, header.data_offset() - sizeof(header) - path.size());
+    
+    constexpr std::size_t chunk_frames = 4096;
+    std::vector<float> chunk(chunk_frames * dec->channels);
+    while (auto frames = dec->read(chunk.data(), chunk_frames)) {
+      out.write((const char*)chunk.data(), frames * dec->channels * sizeof(float));
+      header.num_frames += frames;
+    }
+    
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    if (!out || header.num_frames == 0) {
+      out.close();
+      fs::remove(tmp, ec);
+      return false;
+    }
+  }
+  
+  fs::rename(tmp, entry, ec);
+  if (ec) {
+    fs::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+weave::optional<weave::mapped_audio> weave::audio_file_cache::open(const std::string& path)
+{
+  auto entry = entry_path(path);
+  auto stamp = stamp_of(path);
+  if (!entry || !stamp)
+    return {};
+  
+  auto map_entry = [&] () -> optional<mapped_audio> {
+    mapped_audio res;
+    res.base = map_file(*entry, res.mapped_size);
+    if (!res.base)
+      return {};
+    
+    pcm_cache_header header;
+    if (res.mapped_size < sizeof(header))
+      return {};
+    std::memcpy(&header, res.base, sizeof(header));
+    if (res.mapped_size < header.data_offset())
+      return {};
+    auto stored_path = std::string_view{(const char*)res.base + sizeof(header), header.path_size};
+    if (!describes(header, stored_path, path, *stamp)
+        || res.mapped_size != header.data_offset() + header.num_frames * header.num_channels * sizeof(float))
+      return {};
+    
+    res.data = {(const float*)((const char*)res.base + header.data_offset()), 
+                header.num_frames * header.num_channels};
+    res.num_channels_v = header.num_channels;
+    res.sample_rate_v = header.sample_rate;
+    return res;
+  };
+  
+  std::error_code ec;
+  bool inserted = false;
+  if (fs::exists(*entry, ec))
+    // The modification time of the entry is its last use
+    fs::last_write_time(*entry, fs::file_time_type::clock::now(), ec);
+  else if (decode_to(path, *entry))
+    inserted = true;
+  else
+    return {};
+  
+  auto res = map_entry();
+  // The entry was written for another source with the same hash, or by another version : replace it
+  if (!res && !inserted) {
+    fs::remove(*entry, ec);
+    inserted = decode_to(path, *entry);
+    if (inserted)
+      res = map_entry();
+  }
+  if (!res) {
+    fs::remove(*entry, ec);
+    return {};
+  }
+  
+  // Note : trim after mapping, removing a mapped file doesn't invalidate the mapping
+  if (inserted)
+    trim(max_bytes);
+  return res;
+}
+
+void weave::audio_file_cache::trim(std::uint64_t max)
+{
+  std::lock_guard lock {mut};
+  
+  struct cached_file {
+    fs::path path;
+    fs::file_time_type last_use;
+    std::uint64_t size;
+  };
+  
+  std::error_code ec;
+  std::vector<cached_file> files;
+  std::uint64_t total = 0;
+  for (auto& e : fs::directory_iterator(dir, ec)) {
+    if (e.path().extension() != ".pcm")
+      continue;
+    auto size = e.file_size(ec);
+    if (ec)
+      continue;
+    files.push_back({e.path(), e.last_write_time(ec), size});
+    total += size;
+  }
+  
+  std::ranges::sort(files, {}, &cached_file::last_use);
+  for (auto& f : files) {
+    if (total <= max)
+      break;
+    if (fs::remove(f.path, ec))
+      total -= f.size;
+  }
+}
+
+void weave::impl::set_realtime_priority(std::thread& t)
+{
+#ifdef _WIN32
+  SetThreadPriority(t.native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+  // Note : this fails without the rights to use realtime scheduling, 
+  // the thread then keeps the default priority
+  sched_param param {};
+  param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+  pthread_setschedparam(t.native_handle(), SCHED_FIFO, &param);
+#endif
+}
+
+struct weave::audio_file_writer::wav_state {
+  drwav wav;
+};
+
+weave::audio_file_writer::audio_file_writer() = default;
+
+weave::audio_file_writer::~audio_file_writer() {
+  close();
+}
+
+bool weave::audio_file_writer::open(const std::string& path, int channels, int sample_rate)
+{
+  close();
+  drwav_data_format format;
+  format.container = drwav_container_riff;
+  format.format = DR_WAVE_FORMAT_IEEE_FLOAT;
+  format.channels = channels;
+  format.sampleRate = sample_rate;
+  format.bitsPerSample = 32;
+  
+  auto res = std::make_unique<wav_state>();
+  if (!drwav_init_file_write(&res->wav, path.c_str(), &format, nullptr))
+    return false;
+  wav = std::move(res);
+  num_channels = channels;
+  return true;
+}
+
+bool weave::audio_file_writer::close()
+{
+  bool ok = !wav || drwav_uninit(&wav->wav) == DRWAV_SUCCESS;
+  wav.reset();
+  return ok;
+}
+
+std::size_t weave::audio_file_writer::write(std::span<const float> samples)
+{
+  if (!wav)
+    return 0;
+  return drwav_write_pcm_frames(&wav->wav, samples.size() / num_channels, samples.data());
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <bit>
+
+namespace weave {
+
+/// A wait free ring buffer for one producer thread and one consumer thread, with bulk reads 
+/// and writes, eg. for streaming samples to the audio thread.
+/// The capacity is rounded up to a power of two.
+template <class T>
+struct spsc_ring_buffer {
+  
+  spsc_ring_buffer(std::size_t min_capacity = 0) {
+    reset(min_capacity);
+  }
+  
+  /// Not thread safe, allocates
+  void reset(std::size_t min_capacity) {
+    data.assign(std::bit_ceil(std::max<std::size_t>(min_capacity, 1)), T{});
+    write_pos = 0;
+    read_pos = 0;
+  }
+  
+  std::size_t capacity() const { return data.size(); }
+  
+  /// The number of elements which can be read
+  std::size_t available() const {
+    return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire);
+  }
+  
+  /// The number of elements which can be written
+  std::size_t free_space() const {
+    return capacity() - available();
+  }
+  
+  /// Producer thread only, returns the number of elements written
+  std::size_t write(std::span<const T> src) {
+    auto w = write_pos.load(std::memory_order_relaxed);
+    auto n = std::min(src.size(), capacity() - (w - read_pos.load(std::memory_order_acquire)));
+    copy_to_ring(src.data(), n, w);
+    write_pos.store(w + n, std::memory_order_release);
+    return n;
+  }
+  
+  /// Consumer thread only, returns the number of elements read
+  std::size_t read(std::span<T> dst) {
+    auto r = read_pos.load(std::memory_order_relaxed);
+    auto n = std::min(dst.size(), write_pos.load(std::memory_order_acquire) - r);
+    copy_from_ring(dst.data(), n, r);
+    read_pos.store(r + n, std::memory_order_release);
+    return n;
+  }
+  
+  /// The total number of elements written so far
+  std::size_t write_position() const {
+    return write_pos.load(std::memory_order_acquire);
+  }
+  
+  /// Consumer thread only, the total number of elements read or discarded so far
+  std::size_t read_position() const {
+    return read_pos.load(std::memory_order_relaxed);
+  }
+  
+  /// Consumer thread only, drop every element written before pos
+  void discard_until(std::size_t pos) {
+    if (pos > read_pos.load(std::memory_order_relaxed))
+      read_pos.store(pos, std::memory_order_release);
+  }
+  
+  private : 
+  
+  void copy_to_ring(const T* src, std::size_t n, std::size_t pos) {
+    auto start = pos & (capacity() - 1);
+    auto first = std::min(n, capacity() - start);
+    std::copy_n(src, first, data.begin() + start);
+    std::copy_n(src + first, n - first, data.begin());
+  }
+  
+  void copy_from_ring(T* dst, std::size_t n, std::size_t pos) const {
+    auto start = pos & (capacity() - 1);
+    auto first = std::min(n, capacity() - start);
+    std::copy_n(data.begin() + start, first, dst);
+    std::copy_n(data.begin(), n - first, dst + first);
+  }
+  
+  std::vector<T> data;
+  alignas(64) std::atomic<std::size_t> write_pos = 0;
+  alignas(64) std::atomic<std::size_t> read_pos = 0;
+};
+
+} // weave
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "views_core.hpp"
+#include "modifiers.hpp"
+#include "../audio.hpp"
+
+#include <functional>
+#include <format>
+
+namespace weave::widgets {
+
+/// A bar showing the average load of an audio callback, with a mark at the peak load,
+/// and the number of overruns and xruns.
+struct audio_load_meter : widget_base {
+  
+  auto size_info() const {
+    widget_size_info res;
+    res.min = point{80, 15};
+    res.nominal = point{200, 15};
+    res.max.y = 15;
+    res.flex_factor = point{1, 0};
+    return res;
+  }
+  
+  void on(ignore, ignore) {}
+  
+  /// Poll the statistics every period_ms
+  void start_polling(auto& ctx, int period_ms) {
+    polling = true;
+    ctx.animate(*this, update, period_ms);
+  }
+  
+  /// Poll the statistics every period_ms once the widget is mounted, from a build
+  void start_polling_on_mount(auto& ctx, int period_ms) {
+    polling = true;
+    ctx.animate_on_mount(*this, update, period_ms);
+  }
+  
+  void paint(painter& p) {
+    auto load = std::min(stats.average_load, 1.f);
+    auto col = stats.average_load < 0.5f ? rgba_f{colors::green}
+             : stats.average_load < 0.8f ? rgba_f{colors::yellow} : rgba_f{colors::red};
+    p.fill_style(col.with_alpha(0.4f));
+    p.fill(rectangle({size().x * load, size().y}));
+    
+    auto peak_x = size().x * std::min(stats.peak_load, 1.f);
+    p.stroke_style(col);
+    p.line({peak_x, 0}, {peak_x, size().y}, 1);
+    
+    p.stroke_style(colors::white);
+    p.stroke(rectangle(size()));
+    
+    p.font_size(11);
+    p.fill_style(colors::white);
+    p.text_align(text_align::x::left, text_align::y::center);
+    p.text({3, size().y / 2}, std::format("DSP {:.0f}%  peak {:.0f}%  xruns {}",
+                                          stats.average_load * 100, stats.peak_load * 100,
+                                          stats.num_overruns + stats.num_xruns));
+  }
+  
+  std::function<audio_load_stats()> poll;
+  audio_load_stats stats;
+  bool polling = false;
+  
+  private :
+  
+  static bool update(audio_load_meter& w, ignore) {
+    w.stats = w.poll();
+    return w.polling;
+  }
+};
+
+} // widgets
+
+namespace weave::views {
+
+/// Shows the load statistics of an audio_renderer, polled with an animation
+template <class Renderer>
+struct audio_load_meter : view<audio_load_meter<Renderer>>, view_modifiers {
+  
+  using widget_t = widgets::audio_load_meter;
+  
+  audio_load_meter(Renderer& renderer, int period_ms = 250)
+  : renderer{renderer}, period_ms{period_ms}
+  {
+  }
+  
+  auto build(const build_context& ctx, ignore) {
+    widget_t res {{ctx.new_id(), {200, 15}}};
+    res.poll = [r = &renderer] { return r->load_stats(); };
+    res.start_polling_on_mount(ctx.application_context(), period_ms);
+    return res;
+  }
+  
+  rebuild_result rebuild(const audio_load_meter& old, widget_ref elem, const build_context& ctx, ignore) {
+    auto& w = elem.as<widget_t>();
+    if (&renderer != &old.renderer)
+      w.poll = [r = &renderer] { return r->load_stats(); };
+    if (period_ms != old.period_ms) {
+      ctx.application_context().deanimate(elem);
+      w.start_polling(ctx.application_context(), period_ms);
+    }
+    return {};
+  }
+  
+  void destroy(widget_ref elem, application_context& ctx) {
+    ctx.deanimate(elem);
+  }
+  
+  Renderer& renderer;
+  int period_ms;
+};
+
+} // views
@@ -123,9 +123,9 @@ struct trigger_button : widget_base {
     if (disabled)
       return;
     if (e.is_enter()) 
-      (hovered = true, ec.request_repaint());
+      (hovered = true, ec.request_repaint(*this));
     else if (e.is_exit())
-      (hovered = false, ec.request_repaint());
+      (hovered = false, ec.request_repaint(*this));
     if (!e.is_down())
       return;
     on_click(ec, id());
@@ -276,9 +276,9 @@ struct graphic_toggle_button : widget_base {
   
   void on(mouse_event e, event_context& ec) {
     if (e.is_enter())
-      (hovered = true, ec.request_repaint());
+      (hovered = true, ec.request_repaint(*this));
     else if (e.is_exit())
-      (hovered = false, ec.request_repaint());
+      (hovered = false, ec.request_repaint(*this));
     else if (e.is_down()) 
       flag = write(ec, !flag);
   }
@@ -310,9 +310,9 @@ struct graphic_trigger_button : widget_base {
   
   void on(mouse_event e, event_context& ec) {
     if (e.is_enter())
-      (hovered = true, ec.request_repaint());
+      (hovered = true, ec.request_repaint(*this));
     else if (e.is_exit())
-      (hovered = false, ec.request_repaint());
+      (hovered = false, ec.request_repaint(*this));
     else if (e.is_down())
       on_click(ec);
   }
@@ -3,6 +3,8 @@
 #include "views_core.hpp"
 #include <ranges>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 namespace weave::views {
 
@@ -64,4 +66,118 @@ for_each(R&, C) -> for_each<std::conditional_t<std::ranges::view<R>, R, R&>, C>;
 template <class R, class C>
 for_each(R&&, C) -> for_each<R, C>;
 
-} // views
+namespace impl {
+  
+  /// The indexes 0..n-1 not removed yet, with the number of them before an index 
+  /// in O(log n) (a Fenwick tree)
+  struct remaining_indexes {
+    
+    explicit remaining_indexes(unsigned n) : tree(n + 1, 0), alive(n, true) {
+      for (unsigned k = 1; k <= n; ++k) {
+        tree[k] += 1;
+        if (auto parent = k + (k & -k); parent <= n)
+          tree[parent] += tree[k];
+      }
+    }
+    
+    /// The number of indexes left before k
+    unsigned count_before(unsigned k) const {
+      unsigned res = 0;
+      for (; k > 0; k -= k & -k)
+        res += tree[k];
+      return res;
+    }
+    
+    void remove(unsigned k) {
+      alive[k] = false;
+      for (++k; k < tree.size(); k += k & -k)
+        tree[k] -= 1;
+    }
+    
+    bool contains(unsigned k) const { return alive[k]; }
+    
+    private :
+    
+    std::vector<unsigned> tree;
+    std::vector<bool> alive;
+  };
+}
+
+/// A for_each where elements are matched by key between rebuilds instead of by position.
+/// Widgets of elements which were moved are moved along instead of being rebuilt from another 
+/// element, and only the added or removed keys are built or destroyed.
+/// KeyFn maps an element of the range to a hashable value, which is stored between rebuilds.
+template <class Range, class KeyFn, class ViewCtor>
+struct keyed_for_each : view_sequence_base {
+  
+  keyed_for_each(auto&& range, KeyFn key_fn, ViewCtor ctor) 
+  : range{WEAVE_FWD(range)}, key_fn{key_fn}, view_ctor{ctor} {}
+  
+  using element = decltype( std::declval<ViewCtor>()(*std::declval<Range>().begin()) );
+  using key_type = std::decay_t<decltype( std::declval<KeyFn>()(*std::declval<Range>().begin()) )>;
+  
+  static_assert( is_view<element>, "keyed_for_each elements must be views, not view sequences" );
+  
+  void seq_build(auto Consumer, const build_context& b, auto& state) {
+    for (auto&& elem : range) {
+      keys.push_back(key_fn(elem));
+      elements.push_back(view_ctor(elem));
+      Consumer( elements.back().build(b, state) );
+    }
+  }
+  
+  rebuild_result seq_rebuild(keyed_for_each& Old, auto&& seq_updater, const build_context& ctx, 
+                             auto& state) 
+  {
+    std::unordered_map<key_type, unsigned> old_index;
+    for (unsigned k = 0; k < Old.keys.size(); ++k)
+      old_index.try_emplace(Old.keys[k], k);
+    
+    // The old elements not matched yet, whose widgets follow the next one in the same order
+    impl::remaining_indexes pending(Old.elements.size());
+    
+    rebuild_result res = {};
+    
+    for (auto&& e : range) {
+      keys.push_back(key_fn(e));
+      elements.push_back(view_ctor(e));
+      
+      auto it = old_index.find(keys.back());
+      if (it == old_index.end()) {
+        elements.back().seq_build( seq_updater.consume_fn(), ctx, state );
+        continue;
+      }
+      
+      auto old_k = it->second;
+      old_index.erase(it);
+      seq_updater.bring_next(pending.count_before(old_k));
+      pending.remove(old_k);
+      res |= elements.back().seq_rebuild(Old.elements[old_k], seq_updater, ctx, state);
+    }
+    
+    for (unsigned k = 0; k < Old.elements.size(); ++k)
+      if (pending.contains(k))
+        Old.elements[k].seq_destroy( seq_updater.destroy_fn(), ctx.application_context() );
+    
+    return res;
+  }
+  
+  void seq_destroy(auto&& Get, application_context& ctx) {
+    for (auto& e : elements)
+      e.seq_destroy(Get, ctx);
+  }
+  
+  Range range;
+  KeyFn key_fn;
+  ViewCtor view_ctor;
+  std::vector<key_type> keys;
+  std::vector<element> elements;
+};
+
+template <class R, class K, class C>
+keyed_for_each(R&, K, C) -> keyed_for_each<std::conditional_t<std::ranges::view<R>, R, R&>, K, C>;
+
+template <class R, class K, class C>
+keyed_for_each(R&&, K, C) -> keyed_for_each<R, K, C>;
+
+} // views
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "views_core.hpp"
 #include "scrollable.hpp"
 #include "modifiers.hpp"
+#include "spatial_index.hpp"
 #include "../util/tuple.hpp"
 #include "../util/util.hpp"
 
@@ -92,7 +93,7 @@ namespace impl {
   }
   
   void resolve_max_constraints(std::span<widget_box> children, 
-                              const std::vector<widget_size_info> sz_infos, int axis, 
+                              const std::vector<widget_size_info>& sz_infos, int axis, 
                               point this_size,
                               stack_data data)
   {
@@ -105,7 +106,8 @@ namespace impl {
     
     for (int k = 0; k < 3; ++k)
     {
-      std::vector<widget_ref> unconstrained;
+      // indexes of the unconstrained children
+      std::vector<unsigned> unconstrained;
       
       for (auto i : iota(children.size())) 
       {
@@ -136,7 +138,7 @@ namespace impl {
           remaining_space += old_sz_axis - sz[axis]; 
         }
         else if (!sz_infos[i].aspect_ratio)
-          unconstrained.push_back(children[i].borrow());
+          unconstrained.push_back(i);
       }
       
       if (std::abs(remaining_space) < 1e-3 || !unconstrained.size())
@@ -145,18 +147,18 @@ namespace impl {
       float sum_unconstrained_flex = 0;
       
       for (auto u : unconstrained)
-        sum_unconstrained_flex += u.size_info().flex_factor[axis];
+        sum_unconstrained_flex += sz_infos[u].flex_factor[axis];
         
       // None of the remaining widget are flexible, nothing to do
       if (sum_unconstrained_flex == 0)
         return;
       
       for (auto u : unconstrained) {
-        auto sz = u.size();
-        auto szi = u.size_info();
+        auto sz = children[u].size();
+        auto& szi = sz_infos[u];
         sz[axis] += remaining_space * szi.flex_factor[axis] / sum_unconstrained_flex;
         sz[axis] = std::min(szi.max[axis], sz[axis]);
-        u.set_size(sz);
+        children[u].set_size(sz);
       }
       
       remaining_space = 0;
@@ -171,7 +173,8 @@ namespace impl {
     {
       float space_to_remove = 0;
       
-      std::vector<widget_ref> unconstrained;
+      // indexes of the unconstrained children
+      std::vector<unsigned> unconstrained;
       
       for (auto i : iota(children.size())) 
       {
@@ -184,7 +187,7 @@ namespace impl {
           children[i].set_size(sz);
         }
         else
-          unconstrained.push_back(children[i].borrow());
+          unconstrained.push_back(i);
       }
       
       if (space_to_remove == 0)
@@ -193,12 +196,12 @@ namespace impl {
       float sum_unconstrained_inv_flex = 0;
       
       for (auto u : unconstrained)
-        sum_unconstrained_inv_flex += 1.f / u.size_info().flex_factor[axis];
+        sum_unconstrained_inv_flex += 1.f / sz_infos[u].flex_factor[axis];
         
       for (auto u : unconstrained) {
-        auto sz = u.size();
-        sz[axis] -= space_to_remove / (u.size_info().flex_factor[axis] * sum_unconstrained_inv_flex);
-        u.set_size(sz);
+        auto sz = children[u].size();
+        sz[axis] -= space_to_remove / (sz_infos[u].flex_factor[axis] * sum_unconstrained_inv_flex);
+        children[u].set_size(sz);
       }
     }
   }
@@ -309,7 +312,10 @@ namespace impl {
     std::vector<int> to_erase;
     int& index;
     widget_id this_id;
+    // some widgets were added or removed
     bool mutated = false;
+    // some widgets were only moved
+    bool reordered = false;
     
     [[no_unique_address]] non_copyable _;
     
@@ -324,6 +330,15 @@ namespace impl {
       return vec[index++].borrow();
     }
     
+    // Moves the widget offset places after the next one, so that it becomes the next one
+    void bring_next(int offset) {
+      if (offset == 0)
+        return;
+      auto it = vec.begin() + index;
+      std::rotate(it, it + offset, it + offset + 1);
+      reordered = true;
+    }
+    
     widget_ref destroy() {
       widget_ref res = vec[index].borrow();
       to_erase.push_back(index++);
@@ -391,9 +406,19 @@ namespace impl {
     if (seq_updater.mutated)
       w.reset_scrollbar();
     
+    // Only bubble up the size change if our own size info changed, otherwise
+    // laying out this subtree is enough
     if (seq_updater.mutated || (res & rebuild_result::size_change)) {
+      auto old_info = w.size_info();
+      w.invalidate_size_info();
+      w.do_layout(w.size());
+      return w.size_info() == old_info ? rebuild_result{} : rebuild_result::size_change;
+    }
+    
+    // The size info doesn't depend on the order of the children, which only need to be placed again
+    if (seq_updater.reordered) {
+      w.needs_layout = true;
       w.do_layout(w.size());
-      return {};
     }
     
     return res;
@@ -413,8 +438,21 @@ struct stack : widget_base, scrollable_base
   // if scrollable
   optional<float> min_scroll_axis;
   
+  // the size info is cached until the children change
+  mutable optional<widget_size_info> cached_size_info;
+  bool needs_layout = true;
+  // Note : the parent sets the size before calling layout, so the size can't tell
+  // whether the children were laid out for it
+  point last_layout_size {-1, -1};
+  
   stack(widget_id id, stack_data d) : widget_base{id}, data{d} {}
   
+  /// Must be called when a children was added, removed, or its size info changed
+  void invalidate_size_info() {
+    cached_size_info.reset();
+    needs_layout = true;
+  }
+  
   rectangle scroll_zone() const {
     return {{0, 0}, size()};
   }
@@ -451,7 +489,13 @@ struct stack : widget_base, scrollable_base
     //  p.stroke(rectangle(size()));
   }
   
-  auto size_info() const {
+  widget_size_info size_info() const {
+    if (!cached_size_info)
+      cached_size_info = compute_size_info();
+    return *cached_size_info;
+  }
+  
+  widget_size_info compute_size_info() const {
     widget_size_info res;
     
     res.flex_factor = point{0, 0};
@@ -498,7 +542,17 @@ struct stack : widget_base, scrollable_base
     return std::all_of(children_vec.begin(), children_vec.end(), fn);
   }
   
+  // Children are placed in order along the axis, so we don't have to test all of them 
+  optional<widget_ref> find_child_at(point pos) {
+    return impl::find_child_at_sorted(children_vec, Axis, pos);
+  }
+  
   void layout(point sz) {
+    // Nothing changed since the last layout
+    if (!needs_layout && sz == last_layout_size)
+      return;
+    needs_layout = false;
+    last_layout_size = sz;
     if (min_scroll_axis)
       sz[1 - Axis] -= scrollable_base::bar_width;
     impl::stack_layout(children_vec, data, Axis, sz);
@@ -524,6 +578,11 @@ struct flow : widget_base, scrollable_base {
   
   flow(widget_id id) : widget_base{id} {}
   
+  /// Must be called when a children was added, removed, or its size info changed
+  void invalidate_size_info() {
+    needs_layout = true;
+  }
+  
   rectangle scroll_zone() const {
     return {{0, 0}, size()};
   }
@@ -548,6 +607,11 @@ struct flow : widget_base, scrollable_base {
   
   void layout(point sz) 
   {
+    if (!needs_layout && sz == last_layout_size)
+      return;
+    needs_layout = false;
+    last_layout_size = sz;
+    grid.clear();
     if (!children_vec.size())
       return;
     
@@ -601,6 +665,13 @@ struct flow : widget_base, scrollable_base {
     return std::all_of(children_vec.begin(), children_vec.end(), fn);
   }
   
+  // The grid is built lazily after a layout, in unscrolled coordinates
+  optional<widget_ref> find_child_at(point pos) {
+    if (grid.empty())
+      grid.build(children_vec, {0, scroll_offset});
+    return grid.find(children_vec, pos, {0, scroll_offset});
+  }
+  
   void paint(painter& p) {
     p.fill_style(background_color);
     p.fill(rounded_rectangle(size(), rounded_radius));
@@ -620,6 +691,9 @@ struct flow : widget_base, scrollable_base {
   float rounded_radius = 0;
   float scroll_offset = 0;
   float total_height = 0;
+  bool needs_layout = true;
+  point last_layout_size {-1, -1};
+  impl::spatial_grid grid;
 };
 
 } // widgets
@@ -649,8 +723,17 @@ struct stack_base : view<stack_base<T, Ts...>>, stack<Ts...> {
   template <class S>
   rebuild_result rebuild(auto& Old, widget_ref wb, const build_context& ctx, S& state) {
     auto& wl = wb.as<T>();
-    wl.min_scroll_axis = min_scroll_sz;
-    return impl::rebuild_stack<T>(*this, Old, wb, ctx, state);
+    bool scroll_changed = wl.min_scroll_axis != min_scroll_sz;
+    if (scroll_changed) {
+      wl.min_scroll_axis = min_scroll_sz;
+      wl.invalidate_size_info();
+    }
+    auto res = impl::rebuild_stack<T>(*this, Old, wb, ctx, state);
+    if (scroll_changed && wl.needs_layout) {
+      wl.do_layout(wl.size());
+      res |= rebuild_result::size_change;
+    }
+    return res;
   }
   
   void destroy(widget_ref w, application_context& ctx) {
@@ -106,6 +106,16 @@ struct with_popup_menu : W {
   std::function<popup_menu(event_context&)> popup_opener;
 };
 
+/// Paints W and its children once in an offscreen layer, then draws the layer as a texture
+/// until it's invalidated
+template <class W>
+struct cached_layer : W {
+  
+  render_layer& offscreen_layer() { return layer; }
+  
+  render_layer layer;
+};
+
 } // widgets
 
 namespace weave::views {
@@ -280,6 +290,36 @@ struct with_popup_menu : V {
   Fn opener;
 };
 
+template <class V>
+struct cached_layer : V {
+  
+  using widget_t = widgets::cached_layer<typename V::widget_t>;
+  
+  auto build(const build_context& ctx, auto& state) {
+    auto res = widget_t{ V::build(ctx, state) };
+    ctx.application_context().add_offscreen_layer(res.id());
+    return res;
+  }
+  
+  rebuild_result rebuild(const cached_layer<V>& Old, widget_ref r, const build_context& ctx, auto& state) {
+    auto& wb = r.as<widget_t>();
+    auto res = V::rebuild((V&)Old, widget_ref{&static_cast<typename V::widget_t&>(wb)}, ctx, state);
+    if (!version || version != Old.version)
+      wb.layer.invalidate();
+    return res;
+  }
+  
+  void destroy(widget_ref r, application_context& ctx) {
+    auto& wb = r.as<widget_t>();
+    ctx.remove_offscreen_layer(wb.id());
+    ctx.graphics_context().delete_layer(wb.layer);
+    V::destroy(widget_ref((typename V::widget_t*)&wb), ctx);
+  }
+  
+  // without a version, the layer is painted again on every rebuild
+  optional<unsigned> version;
+};
+
 /// Common extensions for views.
 struct view_modifiers {
 
@@ -353,6 +393,17 @@ struct view_modifiers {
   auto with_popup_menu(this auto&& self, auto&& opener) {
     return views::with_popup_menu{WEAVE_FWD(self), WEAVE_FWD(opener)};
   }
+  
+  /// Paint the view and its children in an offscreen layer, drawn as a texture until 
+  /// the next rebuild, or until a widget inside it requests a repaint or is animated
+  auto cached_layer(this auto&& self) {
+    return views::cached_layer{WEAVE_FWD(self), optional<unsigned>{}};
+  }
+  
+  /// Like cached_layer(), but rebuilds only invalidate the layer when version changes
+  auto cached_layer(this auto&& self, unsigned version) {
+    return views::cached_layer{WEAVE_FWD(self), optional<unsigned>{version}};
+  }
 };
 
 template <class V, class B>
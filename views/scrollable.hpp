@@ -31,7 +31,7 @@ struct scrollable_base {
       drag_delta = self.scrollbar_pos - old_bar_pos;
       auto scrollable_delta = self.scroll_size() * drag_delta / self.scroll_zone().size.y;
       self.displace_scroll(scrollable_delta);
-      ec.request_repaint();
+      ec.request_repaint(self);
     }
   }
   
@@ -59,7 +59,9 @@ struct scrollable_base {
   }
   
   void reset_scrollbar(this auto& self) {
-    self.displace_scroll(-self.scrollbar_pos * self.scroll_size() / self.scroll_zone().size.y);
+    // an empty zone can't have scrolled
+    if (auto h = self.scroll_zone().size.y; h > 0)
+      self.displace_scroll(-self.scrollbar_pos * self.scroll_size() / h);
     self.scrollbar_pos = 0;
   }
   
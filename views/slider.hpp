@@ -137,7 +137,7 @@ struct slider : widget_base
     auto written_val = write_scaled ? scaled_value() : ratio; 
     write(ec, written_val);
     set_ratio(ratio);
-    ec.request_repaint();
+    ec.request_repaint(*this);
   }
   
   void paint(painter& p) 
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "../core/widget.hpp"
+
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace weave::impl {
+
+/// Finds the child at pos in a list of children laid out in order along an axis,
+/// as in a stack. Bisects on the axis instead of scanning every child.
+inline optional<widget_ref> find_child_at_sorted(std::span<widget_box> children, int axis,
+                                                  point pos)
+{
+  // first child that doesn't end before pos
+  auto it = std::partition_point(children.begin(), children.end(), [axis, pos] (auto& c) {
+    return c.position()[axis] + c.size()[axis] < pos[axis];
+  });
+  // Note : with no interspace, two children can share a border
+  for (; it != children.end() && it->position()[axis] <= pos[axis]; ++it) {
+    if (it->contains(pos))
+      return it->borrow();
+  }
+  return {};
+}
+
+/// A uniform grid over the children of a free form container, to find the child
+/// at a position without testing every child.
+/// Children are stored by index in every cell they overlap, in increasing order,
+/// so the first match is the same as with a linear scan.
+struct spatial_grid {
+  
+  bool empty() const { return cell_begin.empty(); }
+  
+  void clear() {
+    cell_begin.clear();
+    items.clear();
+  }
+  
+  /// Build the grid from the area of the children, translated by offset
+  void build(std::span<widget_box> children, point offset = {0, 0})
+  {
+    clear();
+    if (!children.size())
+      return;
+    
+    auto bounds = children[0].area();
+    point mean_size {0, 0};
+    for (auto& c : children) {
+      bounds = bounds.bounding_union(c.area());
+      mean_size += c.size();
+    }
+    mean_size /= children.size();
+    
+    origin = bounds.origin + offset;
+    cell_size = max(mean_size, point{1, 1});
+    dims.x = std::clamp<int>(std::ceil(bounds.size.x / cell_size.x), 1, max_dim);
+    dims.y = std::clamp<int>(std::ceil(bounds.size.y / cell_size.y), 1, max_dim);
+    cell_size.x = std::max(bounds.size.x / dims.x, 1.f);
+    cell_size.y = std::max(bounds.size.y / dims.y, 1.f);
+    
+    // Two passes : count the children per cell, then fill them in
+    cell_begin.assign(dims.x * dims.y + 1, 0);
+    for_each_cell(children, offset, [this] (int cell, unsigned) { ++cell_begin[cell + 1]; });
+    for (int k = 1; k < (int)cell_begin.size(); ++k)
+      cell_begin[k] += cell_begin[k - 1];
+    
+    items.resize(cell_begin.back());
+    std::vector<unsigned> fill {cell_begin.begin(), cell_begin.end() - 1};
+    for_each_cell(children, offset, [this, &fill] (int cell, unsigned i) {
+      items[fill[cell]++] = i;
+    });
+  }
+  
+  /// The child containing pos, pos being translated by the same offset used in build
+  optional<widget_ref> find(std::span<widget_box> children, point pos, point offset = {0, 0}) const
+  {
+    if (empty())
+      return {};
+    auto c = cell_of(pos + offset);
+    if (c.x < 0 || c.y < 0 || c.x >= dims.x || c.y >= dims.y)
+      return {};
+    auto cell = c.y * dims.x + c.x;
+    for (auto k = cell_begin[cell]; k < cell_begin[cell + 1]; ++k) {
+      auto& w = children[items[k]];
+      if (w.contains(pos))
+        return w.borrow();
+    }
+    return {};
+  }
+  
+  private :
+  
+  static constexpr int max_dim = 256;
+  
+  vec2i cell_of(point p) const {
+    auto c = (p - origin);
+    return {(int)std::floor(c.x / cell_size.x), (int)std::floor(c.y / cell_size.y)};
+  }
+  
+  void for_each_cell(std::span<widget_box> children, point offset, auto&& fn) const {
+    for (unsigned i = 0; i < children.size(); ++i) {
+      auto a = max(cell_of(children[i].position() + offset), vec2i{0, 0});
+      auto b = min(cell_of(children[i].area().end() + offset), dims - 1);
+      for (int y = a.y; y <= b.y; ++y)
+        for (int x = a.x; x <= b.x; ++x)
+          fn(y * dims.x + x, i);
+    }
+  }
+  
+  point origin {0, 0};
+  point cell_size {1, 1};
+  vec2i dims {0, 0};
+  std::vector<unsigned> cell_begin;
+  std::vector<unsigned> items;
+};
+
+} // weave::impl
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "views_core.hpp"
+#include "modifiers.hpp"
+#include "../audio_analysis.hpp"
+
+#include <vector>
+#include <cmath>
+
+namespace weave::widgets {
+
+/// Base of the widgets reading an audio_tap once per frame
+struct audio_tap_reader : widget_base {
+  
+  void on(ignore, ignore) {}
+  
+  /// Read the tap on every frame once the widget is mounted, from a build
+  void start_polling_on_mount(this auto& self, auto& ctx) {
+    self.polling = true;
+    ctx.animate_frames_on_mount(self, [] (auto& w, ignore) {
+      std::size_t n;
+      while (w.tap && (n = w.tap->read(w.read_buffer)))
+        w.consume(std::span{w.read_buffer}.first(n));
+      return w.polling;
+    });
+  }
+  
+  audio_tap* tap = nullptr;
+  std::vector<float> read_buffer = std::vector<float>(4096);
+  bool polling = false;
+};
+
+/// The spectrum of the audio of a tap, on a logarithmic frequency scale
+struct spectrum : audio_tap_reader {
+  
+  auto size_info() const {
+    widget_size_info res;
+    res.min = point{100, 50};
+    res.nominal = point{400, 200};
+    res.flex_factor = point{1, 1};
+    return res;
+  }
+  
+  void consume(std::span<const float> samples) {
+    analyzer.feed(samples);
+  }
+  
+  void paint(painter& p) {
+    p.fill_style(colors::black);
+    p.fill(rectangle(size()));
+    
+    auto bins = analyzer.magnitudes();
+    auto nyquist = sample_rate / 2;
+    auto x_of = [this, nyquist] (float freq) {
+      return size().x * std::log(freq / min_frequency) / std::log(nyquist / min_frequency);
+    };
+    auto y_of = [this] (float db) {
+      return size().y * std::clamp(db / min_db, 0.f, 1.f);
+    };
+    
+    p.fill_style(rgba_f{colors::cyan}.with_alpha(0.4f));
+    p.stroke_style(colors::cyan);
+    p.begin_path().move_to({0, size().y});
+    for (std::size_t k = 1; k < bins.size(); ++k) {
+      auto f = analyzer.bin_frequency(k, sample_rate);
+      if (f < min_frequency)
+        continue;
+      p.line_to({x_of(f), y_of(bins[k])});
+    }
+    p.line_to({size().x, size().y});
+    p.close_path();
+    p.fill_path();
+    p.stroke_path(1);
+  }
+  
+  spectrum_analyzer analyzer;
+  float sample_rate = 48000;
+  float min_frequency = 20;
+  // the level at the bottom of the widget
+  float min_db = -90;
+};
+
+/// The waveform of the last samples of a tap, starting at a rising zero crossing
+/// so that periodic signals stand still
+struct oscilloscope : audio_tap_reader {
+  
+  auto size_info() const {
+    widget_size_info res;
+    res.min = point{100, 50};
+    res.nominal = point{400, 200};
+    res.flex_factor = point{1, 1};
+    return res;
+  }
+  
+  void consume(std::span<const float> samples) {
+    history.insert(history.end(), samples.begin(), samples.end());
+    if (history.size() > 2 * window_size)
+      history.erase(history.begin(), history.end() - 2 * window_size);
+  }
+  
+  void paint(painter& p) {
+    p.fill_style(colors::black);
+    p.fill(rectangle(size()));
+    if (history.size() < window_size + 1)
+      return;
+    
+    std::size_t start = 1;
+    auto last_start = history.size() - window_size;
+    while (start < last_start && !(history[start - 1] < 0 && history[start] >= 0))
+      ++start;
+    
+    auto y_of = [this] (float v) { return size().y / 2 * (1 - std::clamp(v, -1.f, 1.f)); };
+    p.stroke_style(colors::green);
+    p.begin_path().move_to({0, y_of(history[start])});
+    for (std::size_t i = 1; i < window_size; ++i)
+      p.line_to({size().x * i / (window_size - 1), y_of(history[start + i])});
+    p.stroke_path(1);
+  }
+  
+  std::vector<float> history;
+  std::size_t window_size = 1024;
+};
+
+} // widgets
+
+namespace weave::views {
+
+namespace impl {
+  
+  /// Common parts of the views reading a tap
+  template <class Derived, class Widget>
+  struct audio_tap_view : view<Derived>, view_modifiers {
+    
+    using widget_t = Widget;
+    
+    audio_tap_view(audio_tap& tap) : tap{tap} {}
+    
+    auto build(this auto& self, const build_context& ctx, ignore) {
+      widget_t res {{{ctx.new_id(), {400, 200}}}};
+      res.tap = &self.tap;
+      self.update(res);
+      res.start_polling_on_mount(ctx.application_context());
+      return res;
+    }
+    
+    rebuild_result rebuild(this auto& self, const Derived& old, widget_ref elem, const build_context& ctx, ignore) {
+      auto& w = elem.as<widget_t>();
+      w.tap = &self.tap;
+      self.update(w);
+      return {};
+    }
+    
+    void destroy(widget_ref elem, application_context& ctx) {
+      ctx.deanimate(elem);
+    }
+    
+    audio_tap& tap;
+  };
+}
+
+/// The spectrum of the audio pushed in a tap. The view must be the only reader of the tap.
+struct spectrum : impl::audio_tap_view<spectrum, widgets::spectrum> {
+  
+  spectrum(audio_tap& tap, float sample_rate) : audio_tap_view{tap}, sample_rate{sample_rate} {}
+  
+  auto& frequency_range_start(float f) {
+    min_frequency = f;
+    return *this;
+  }
+  
+  void update(widgets::spectrum& w) const {
+    w.sample_rate = sample_rate;
+    w.min_frequency = min_frequency;
+  }
+  
+  float sample_rate;
+  float min_frequency = 20;
+};
+
+/// The waveform of the audio pushed in a tap. The view must be the only reader of the tap.
+struct oscilloscope : impl::audio_tap_view<oscilloscope, widgets::oscilloscope> {
+  
+  oscilloscope(audio_tap& tap, std::size_t window_size = 1024)
+  : audio_tap_view{tap}, window_size{window_size} {}
+  
+  void update(widgets::oscilloscope& w) const {
+    w.window_size = window_size;
+  }
+  
+  std::size_t window_size;
+};
+
+} // views
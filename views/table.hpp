@@ -49,6 +49,11 @@ struct table : widget_base, scrollable_base {
   std::optional<text_field> edited_field;
   int dragging = -1;
   float scroll_offset = 0;
+  // reused every paint, so that painting doesn't allocate
+  std::vector<rectangle> selection_rects;
+  std::vector<segment> separators;
+  // the background and the header, which only change with the properties
+  paint_cache header_cache {true};
   
   widget_action<vec2i, std::string_view> on_field_edit;
   widget_action<int> cell_double_click;
@@ -86,6 +91,7 @@ struct table : widget_base, scrollable_base {
       properties.push_back({*it++, pos_end});
       pos_end += avg_width;
     }
+    header_cache.invalidate();
   }
   
   template <class T>
@@ -107,6 +113,7 @@ struct table : widget_base, scrollable_base {
     });
     property_sort_index = property_index;
     property_sort_order = less;
+    header_cache.invalidate();
   }
   
   std::optional<vec2i> find_cell_at(point pos) const {
@@ -129,7 +136,7 @@ struct table : widget_base, scrollable_base {
   {
     if (e.is_down() && edited_field) {
       edited_field.reset();
-      Ec.request_repaint();
+      Ec.request_repaint(*this);
     }
     
     if (scrollable_base::on(e, Ec))
@@ -140,7 +147,7 @@ struct table : widget_base, scrollable_base {
         handle_mouse_down_header(e.position);
       else 
         handle_mouse_down_body(e, Ec);
-      Ec.request_repaint();
+      Ec.request_repaint(*this);
       return;
     }
     
@@ -157,6 +164,7 @@ struct table : widget_base, scrollable_base {
         auto max = col_end - margin;
         posx = std::min(max, posx);
       }
+      header_cache.invalidate();
       if (edited_field) { 
         auto p = edited_field->position();
         if (focused_cell->x == dragging) {
@@ -169,7 +177,7 @@ struct table : widget_base, scrollable_base {
           edited_field->set_size( {w, edited_field->size().y} );
         }
       }
-      Ec.request_repaint();
+      Ec.request_repaint(*this);
       return;
     }
     
@@ -185,16 +193,18 @@ struct table : widget_base, scrollable_base {
   static constexpr float margin = 5;
   
   void paint(painter& p) {
-    // background
-    auto background_col = rgb_f(colors::gray) * 0.3;
-    p.fill_style(rgba_f(colors::black) * 0.3);
-    p.fill(rectangle({size().x, first_row})); // header background
+    p.cached(header_cache, {size().x, first_row}, [&] {
+      // background
+      p.fill_style(rgba_f(colors::black) * 0.3);
+      p.fill(rectangle({size().x, first_row})); // header background
+      
+      paint_header(p);
+    });
+    
     // outline
     p.stroke_style(rgba_f(colors::black) * 0.5);
     p.stroke(rectangle(size()));
     
-    paint_header(p);
-    
     {
       auto _ = p.translate({0, first_row});
       auto _ = p.scissor({0, 0}, scroll_zone().size);
@@ -316,12 +326,14 @@ struct table : widget_base, scrollable_base {
     
     p.text_align(text_align::x::left, text_align::y::center);
     
+    separators.clear();
     for (auto& [prop, posx] : properties) {
       if (posx > size().x)
         break;
-      p.line( {posx, 0}, {posx, first_row}, 1 );
+      separators.push_back({{posx, 0}, {posx, first_row}});
       p.text( {5 + posx, first_row / 2}, prop );
     }
+    p.lines(separators, 1);
     
     // Property order indicator
     if (property_sort_index != -1) {
@@ -338,6 +350,9 @@ struct table : widget_base, scrollable_base {
   }
   
   void paint_body(painter& p, vec2f body_sz) {
+    // Note : the header is cached in its own state
+    p.font_size(13);
+    p.text_align(text_align::x::left, text_align::y::center);
     p.fill_style(colors::white);
     int cells_begin = scroll_offset / row;
     int cells_end = (scroll_offset + scroll_zone().size.y) / row + 1;
@@ -366,10 +381,12 @@ struct table : widget_base, scrollable_base {
     
     if (selection.size()) {
       p.fill_style(rgba{colors::cyan}.with_alpha(70));
+      selection_rects.clear();
       for (auto i : selection) {
         auto pos_y = i * row - scroll_offset;
-        p.fill( rectangle({0, pos_y}, {size().x, row}) );
+        selection_rects.push_back(rectangle({0, pos_y}, {size().x, row}));
       }
+      p.fill_rects(selection_rects);
     }
   }
 };
@@ -22,7 +22,7 @@ struct text : widget_base
   std::string str;
   properties prop;
   float text_width = 0;
-  text_align::x align;
+  text_align::x align = text_align::x::left;
   
   public : 
   
@@ -100,10 +100,13 @@ struct with_label : widget_base {
   }
   
   void paint(painter& p) {
-    p.font_size(11);
-    p.fill_style(colors::white);
-    p.text_align(text_align::x::left, text_align::y::center);
-    p.text({margin, child.size().y / 2}, text);
+    // Note : the label only depends on the height of the child
+    p.cached(cache, {text_size + margin * 2, child.size().y}, [&] {
+      p.font_size(11);
+      p.fill_style(colors::white);
+      p.text_align(text_align::x::left, text_align::y::center);
+      p.text({margin, child.size().y / 2}, text);
+    });
   }
   
   auto traverse_children(auto&& fn) {
@@ -112,12 +115,14 @@ struct with_label : widget_base {
   
   void set_label(std::string str, graphics_context& ctx) {
     text = WEAVE_MOVE(str);
-    text_size = ctx.text_bounds(str, 11).x;
+    text_size = ctx.text_bounds(text, 11).x;
+    cache.invalidate();
   }
   
   void set_label(std::string_view str, graphics_context& ctx) {
     text = std::string{str};
     text_size = ctx.text_bounds(str, 11).x;
+    cache.invalidate();
   }
   
   void on(mouse_event e, event_context& ec) {}
@@ -126,6 +131,7 @@ struct with_label : widget_base {
   
   std::string text;
   float text_size;
+  paint_cache cache {true};
   W child;
 };
 
@@ -5,6 +5,7 @@
 #include "text.hpp"
 #include "button.hpp"
 #include "for_each.hpp"
+#include "virtual_list.hpp"
 #include "either.hpp"
 #include "modifiers.hpp"
 #include "scrollable.hpp"
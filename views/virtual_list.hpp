@@ -0,0 +1,264 @@
+#pragma once
+
+#include "views_core.hpp"
+#include "scrollable.hpp"
+#include "modifiers.hpp"
+
+#include <ranges>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+namespace weave::widgets {
+
+/// A vertical list of rows of the same height, where only the visible rows
+/// (plus an overscan) have a widget.
+struct virtual_list : widget_base, scrollable_base {
+  
+  static constexpr int overscan = 4;
+  
+  virtual_list(widget_id id, float row_height) : widget_base{id}, row_height{row_height} {}
+  
+  struct row_range {
+    unsigned begin, end;
+  };
+  
+  rectangle scroll_zone() const {
+    return {{0, 0}, size()};
+  }
+  
+  float scroll_size() const {
+    return row_count * row_height;
+  }
+  
+  void displace_scroll(float delta) {
+    scroll_offset += delta;
+    place_rows();
+  }
+  
+  /// The rows that should have a widget for the current scroll position
+  row_range wanted_rows(float height) const {
+    auto r = visible_rows(height);
+    r.begin = std::max<int>(0, (int)r.begin - overscan);
+    r.end = std::min(row_count, r.end + overscan);
+    return r;
+  }
+  
+  row_range wanted_rows() const {
+    return wanted_rows(size().y);
+  }
+  
+  /// True if every visible row has a widget, for a height of the list
+  bool covers_visible_rows(float height) const {
+    auto r = visible_rows(height);
+    return r.begin >= first && r.end <= first + rows.size();
+  }
+  
+  bool covers_visible_rows() const {
+    return covers_visible_rows(size().y);
+  }
+  
+  void on(mouse_event e, event_context& ec) {
+    scrollable_base::on(e, ec);
+    if (bind_visible_rows())
+      ec.request_repaint();
+  }
+  
+  void on_child_event(mouse_event e, widget_ref r, event_context& ec) {
+    scrollable_base::on_child_event(e, r, ec);
+    if (bind_visible_rows())
+      ec.request_repaint();
+  }
+  
+  void paint(painter& p) {
+    scrollable_base::paint(p);
+  }
+  
+  widget_size_info size_info() const {
+    widget_size_info res;
+    res.min = {scrollable_base::bar_width, row_height};
+    res.nominal = nominal_size;
+    return res;
+  }
+  
+  bool traverse_children(auto&& fn) {
+    return std::all_of(rows.begin(), rows.end(), fn);
+  }
+  
+  optional<widget_ref> find_child_at(point pos) {
+    auto k = (int)std::floor((pos.y + scroll_offset) / row_height) - (int)first;
+    if (k < 0 || k >= (int)rows.size() || !rows[k].contains(pos))
+      return {};
+    return rows[k].borrow();
+  }
+  
+  void layout(point sz) {
+    // The rows were built for another height, eg. the nominal one before the first layout
+    if (bind_rows && !covers_visible_rows(sz.y))
+      bind_rows(*this, wanted_rows(sz.y));
+    layout_rows(sz.x);
+  }
+  
+  /// Rebind the row widgets to the rows in sight if some visible row has no widget,
+  /// returns true if they were
+  bool bind_visible_rows() {
+    if (!bind_rows || covers_visible_rows())
+      return false;
+    bind_rows(*this, wanted_rows());
+    layout_rows(size().x);
+    return true;
+  }
+  
+  void place_rows() {
+    for (auto k : iota(rows.size()))
+      rows[k].set_position({0, (first + k) * row_height - scroll_offset});
+  }
+  
+  std::vector<widget_box> rows;
+  // index of the row of rows[0]
+  unsigned first = 0;
+  unsigned row_count = 0;
+  float row_height;
+  float scroll_offset = 0;
+  point nominal_size = {300, 300};
+  application_context* app = nullptr;
+  /// Set by the view : recycles the widgets of rows to show a range of rows, building 
+  /// or destroying the missing or extra ones. The list rebinds its rows when it's scrolled 
+  /// past the overscan, without a rebuild of the application.
+  std::function<void(virtual_list&, row_range)> bind_rows;
+  
+  private :
+  
+  void layout_rows(float width) {
+    for (auto& r : rows) {
+      r.set_size({width - scrollable_base::bar_width, row_height});
+      r.layout(r.size());
+    }
+    place_rows();
+  }
+  
+  row_range visible_rows(float height) const {
+    auto h = height > 0 ? height : nominal_size.y;
+    int b = std::floor(scroll_offset / row_height);
+    int e = std::ceil((scroll_offset + h) / row_height);
+    return {(unsigned)std::clamp<int>(b, 0, row_count), (unsigned)std::clamp<int>(e, 0, row_count)};
+  }
+};
+
+} // widgets
+
+namespace weave::views {
+
+/// A list which only builds the views of the rows visible on screen.
+/// Widgets are recycled when scrolling : the widget of a row which goes out of sight
+/// is rebuilt with the view of a row coming into sight, by the list itself, without
+/// a rebuild of the application.
+/// Range must be a random access range, and the rows must have the same height.
+template <class Range, class ViewCtor>
+struct virtual_list : view<virtual_list<Range, ViewCtor>>, view_modifiers {
+  
+  using widget_t = widgets::virtual_list;
+  using element = decltype( std::declval<ViewCtor>()(*std::declval<Range>().begin()) );
+  
+  static_assert( is_view<element>, "virtual_list rows must be views, not view sequences" );
+  
+  virtual_list(auto&& range, float row_height, ViewCtor ctor)
+  : range{WEAVE_FWD(range)}, row_height{row_height}, view_ctor{ctor} {}
+  
+  template <class S>
+  auto build(const build_context& ctx, S& state) {
+    widget_t res {ctx.new_id(), row_height};
+    res.app = &ctx.application_context();
+    res.row_count = std::ranges::size(range);
+    data = std::make_shared<rows_data>(std::forward<Range>(range), std::move(view_ctor));
+    res.bind_rows = row_binder<S>{data, &state};
+    res.bind_rows(res, res.wanted_rows());
+    return res;
+  }
+  
+  template <class S>
+  rebuild_result rebuild(virtual_list& Old, widget_ref wb, const build_context& ctx, S& state) {
+    auto& w = wb.as<widget_t>();
+    
+    unsigned count = std::ranges::size(range);
+    if (count != w.row_count) {
+      w.reset_scrollbar();
+      w.row_count = count;
+    }
+    
+    data = std::make_shared<rows_data>(std::forward<Range>(range), std::move(view_ctor), 
+                                       std::move(Old.data->elements));
+    w.bind_rows = row_binder<S>{data, &state};
+    w.bind_rows(w, w.wanted_rows());
+    w.do_layout(w.size());
+    return {};
+  }
+  
+  void destroy(widget_ref wb, application_context& ctx) {
+    auto& w = wb.as<widget_t>();
+    for (auto k : iota(data->elements.size()))
+      data->elements[k].destroy(w.rows[k].borrow(), ctx);
+  }
+  
+  private :
+  
+  // The range and the views of the rows, shared with the widget which rebinds its rows 
+  // when it's scrolled, until the next rebuild
+  struct rows_data {
+    Range range;
+    ViewCtor view_ctor;
+    std::vector<element> elements = {};
+  };
+  
+  // Recycles the existing widgets, whatever row they were showing, for the rows in [begin, end)
+  template <class S>
+  struct row_binder {
+    
+    void operator()(widget_t& w, widgets::virtual_list::row_range wanted) const {
+      auto ctx = build_context{*w.app};
+      auto& old = data->elements;
+      std::vector<element> res;
+      unsigned new_size = wanted.end - wanted.begin;
+      unsigned old_size = w.rows.size();
+      
+      for (unsigned k = 0; k < std::min(new_size, old_size); ++k) {
+        res.push_back(data->view_ctor(std::ranges::begin(data->range)[wanted.begin + k]));
+        res.back().rebuild(old[k], w.rows[k].borrow(), ctx, *state);
+      }
+      for (unsigned k = old_size; k < new_size; ++k) {
+        res.push_back(data->view_ctor(std::ranges::begin(data->range)[wanted.begin + k]));
+        w.rows.push_back( widget_box{res.back().build(ctx, *state)} );
+        w.rows.back().mount(ctx.widget_tree(), w.id());
+      }
+      for (unsigned k = new_size; k < old_size; ++k) {
+        old[k].destroy(w.rows[k].borrow(), ctx.application_context());
+        w.rows[k].unmount(ctx.widget_tree());
+      }
+      if (new_size < old_size)
+        w.rows.erase(w.rows.begin() + new_size, w.rows.end());
+      
+      old = std::move(res);
+      w.first = wanted.begin;
+    }
+    
+    std::shared_ptr<rows_data> data;
+    S* state;
+  };
+  
+  public :
+  
+  Range range;
+  float row_height;
+  ViewCtor view_ctor;
+  std::shared_ptr<rows_data> data;
+};
+
+template <class R, class C>
+virtual_list(R&, float, C) -> virtual_list<std::conditional_t<std::ranges::view<R>, R, R&>, C>;
+
+template <class R, class C>
+virtual_list(R&&, float, C) -> virtual_list<R, C>;
+
+} // weave::views
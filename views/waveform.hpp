@@ -0,0 +1,163 @@
+#pragma once
+
+#include "views_core.hpp"
+#include "modifiers.hpp"
+#include "../audio.hpp"
+
+#include <vector>
+#include <span>
+
+namespace weave::widgets {
+
+/// Draws the channels of an audio buffer from its waveform_peaks, one lane per channel.
+struct waveform : widget_base {
+  
+  auto size_info() const {
+    widget_size_info res;
+    res.min = point{50, 30};
+    res.nominal = point{400, 150};
+    res.flex_factor = point{1, 1};
+    return res;
+  }
+  
+  void on(ignore, ignore) {}
+  
+  // Note : the new size is only set once layout returns
+  void layout(point sz) {
+    update_columns(sz.x);
+  }
+  
+  /// Query the peaks of every pixel column, in O(width) whatever the zoom level
+  void update_columns(int width) {
+    if (!peaks || !peaks->num_frames() || width <= 0) {
+      columns.clear();
+      return;
+    }
+    auto channels = peaks->num_channels();
+    columns.resize(channels * width);
+    auto last = (last_frame > first_frame) ? last_frame : (double)peaks->num_frames();
+    auto frames_per_column = (last - first_frame) / width;
+    for (int c = 0; c < channels; ++c)
+      peaks->columns(c, first_frame, frames_per_column,
+                     std::span{columns}.subspan(c * width, width), samples);
+  }
+  
+  void paint(painter& p) {
+    p.fill_style(background_color);
+    p.fill(rectangle(size()));
+    if (columns.empty())
+      return;
+    
+    int width = size().x;
+    int channels = columns.size() / width;
+    auto lane_height = size().y / channels;
+    
+    for (int c = 0; c < channels; ++c) {
+      auto lane = std::span{columns}.subspan(c * width, width);
+      auto center = (c + 0.5f) * lane_height;
+      auto y = [center, lane_height] (float v) {
+        return center - std::clamp(v, -1.f, 1.f) * lane_height / 2;
+      };
+      
+      // Note : each band is a single path, going forward on its top edge and backward on its bottom edge
+      p.fill_style(static_cast<rgba_f>(color).with_alpha(0.5f));
+      p.begin_path().move_to({0, y(lane[0].max)});
+      for (int x = 1; x < width; ++x)
+        p.line_to({(float)x, y(lane[x].max)});
+      for (int x = width - 1; x >= 0; --x)
+        p.line_to({(float)x, y(lane[x].min)});
+      p.close_path().fill_path();
+      
+      p.fill_style(color);
+      p.begin_path().move_to({0, y(lane[0].rms())});
+      for (int x = 1; x < width; ++x)
+        p.line_to({(float)x, y(lane[x].rms())});
+      for (int x = width - 1; x >= 0; --x)
+        p.line_to({(float)x, y(-lane[x].rms())});
+      p.close_path().fill_path();
+    }
+  }
+  
+  const waveform_peaks* peaks = nullptr;
+  std::span<const float> samples;
+  double first_frame = 0;
+  // if not greater than first_frame, the end of the buffer
+  double last_frame = 0;
+  rgba_u8 color = colors::cyan;
+  rgba_u8 background_color = colors::black;
+  std::vector<waveform_peak> columns;
+};
+
+} // widgets
+
+namespace weave::views {
+
+/// Displays an audio buffer from its waveform_peaks.
+/// The peaks are only queried when they, the visible range or the size of the widget change.
+struct waveform : view<waveform>, view_modifiers {
+  
+  using widget_t = widgets::waveform;
+  
+  /// samples is optional, and only used to draw exactly the ranges smaller than a block of the peaks
+  waveform(const waveform_peaks& peaks, std::span<const float> samples = {})
+  : peaks{peaks}, samples{samples}
+  {
+  }
+  
+  /// Only show the frames in [first, last)
+  auto& frames(double first, double last) {
+    first_frame = first;
+    last_frame = last;
+    return *this;
+  }
+  
+  auto& color(rgba_u8 c) {
+    wave_color = c;
+    return *this;
+  }
+  
+  auto& background_color(rgba_u8 c) {
+    bg_color = c;
+    return *this;
+  }
+  
+  auto build(const build_context& ctx, ignore) {
+    widget_t res {{ctx.new_id(), {400, 150}}};
+    update(res);
+    version = peaks.version();
+    return res;
+  }
+  
+  rebuild_result rebuild(const waveform& old, widget_ref elem, const build_context& ctx, ignore) {
+    auto& w = elem.as<widget_t>();
+    version = peaks.version();
+    if (&peaks != &old.peaks || version != old.version || samples.data() != old.samples.data()
+        || first_frame != old.first_frame || last_frame != old.last_frame
+        || wave_color != old.wave_color || bg_color != old.bg_color)
+      update(w);
+    return {};
+  }
+  
+  void destroy(widget_ref w) {}
+  
+  private :
+  
+  void update(widget_t& w) const {
+    w.peaks = &peaks;
+    w.samples = samples;
+    w.first_frame = first_frame;
+    w.last_frame = last_frame;
+    w.color = wave_color;
+    w.background_color = bg_color;
+    w.update_columns(w.size().x);
+  }
+  
+  const waveform_peaks& peaks;
+  std::span<const float> samples;
+  unsigned version = 0;
+  double first_frame = 0, last_frame = 0;
+  rgba_u8 wave_color = colors::cyan;
+  rgba_u8 bg_color = colors::black;
+};
+
+} // views
@@ -3,4 +3,7 @@
 #include "core/application.hpp"
 #include "core/app_state.hpp"
 #include "views/views.hpp"
-#include "audio.hpp"
\ No newline at end of file
+#include "audio.hpp"
+#include "views/waveform.hpp"
+#include "views/audio_meter.hpp"
+#include "views/spectrum.hpp"
\ No newline at end of file